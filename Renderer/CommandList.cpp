@@ -0,0 +1,138 @@
+#include "CommandList.hpp"
+
+using namespace renderlib;
+
+void CommandList::setVertexShader(std::function<Vertex (const Vertex& vertex)> vertexShader) {
+	record(setVertexShaderCommand, 0, 0, store(_vertexShaders, vertexShader));
+}
+
+void CommandList::setPixelShader(std::function<vec4 (const Vertex& fragment)> pixelShader) {
+	record(setPixelShaderCommand, 0, 0, store(_pixelShaders, pixelShader));
+}
+
+void CommandList::setTexture(const TextureHandle& texture) {
+	record(setTextureCommand, 0, 0, store(_textures, texture));
+}
+
+void CommandList::setIndexBuffer(const IndexBufferHandle& indexBuffer) {
+	record(setIndexBufferCommand, 0, 0, store(_indexBuffers, indexBuffer));
+}
+
+void CommandList::setIndexBuffer(const ShortIndexBufferHandle& indexBuffer) {
+	record(setShortIndexBufferCommand, 0, 0, store(_shortIndexBuffers, indexBuffer));
+}
+
+void CommandList::append(const CommandList& commandList) {
+	if (&commandList == this) {
+		// the tables grow while they are appended, so a list appends a copy of itself
+		const CommandList copy(commandList);
+		append(copy);
+		return;
+	}
+	// resources of the appended list follow the ones of this list in every table
+	const uint32_t offsets[] = {
+		static_cast<uint32_t>(_vertexShaders.size()),
+		static_cast<uint32_t>(_pixelShaders.size()),
+		static_cast<uint32_t>(_textures.size()),
+		static_cast<uint32_t>(_vertexBuffers.size()),
+		static_cast<uint32_t>(_indexBuffers.size()),
+		static_cast<uint32_t>(_shortIndexBuffers.size())
+	};
+	const uint32_t templateDrawOffset = static_cast<uint32_t>(_templateDraws.size());
+	for (Command command : commandList._commands) {
+		if (command.type <= setShortIndexBufferCommand) {
+			command.resource += offsets[command.type];
+		}
+		else if (command.type == drawTemplateCommand) {
+			command.resource += templateDrawOffset;
+		}
+		_commands.push_back(command);
+	}
+	_vertexShaders.insert(_vertexShaders.end(), commandList._vertexShaders.begin(), commandList._vertexShaders.end());
+	_pixelShaders.insert(_pixelShaders.end(), commandList._pixelShaders.begin(), commandList._pixelShaders.end());
+	_textures.insert(_textures.end(), commandList._textures.begin(), commandList._textures.end());
+	_vertexBuffers.insert(_vertexBuffers.end(), commandList._vertexBuffers.begin(), commandList._vertexBuffers.end());
+	_indexBuffers.insert(_indexBuffers.end(), commandList._indexBuffers.begin(), commandList._indexBuffers.end());
+	_shortIndexBuffers.insert(_shortIndexBuffers.end(), commandList._shortIndexBuffers.begin(), commandList._shortIndexBuffers.end());
+	_templateDraws.insert(_templateDraws.end(), commandList._templateDraws.begin(), commandList._templateDraws.end());
+}
+
+void CommandList::clear(void) {
+	_commands.clear();
+	_vertexShaders.clear();
+	_pixelShaders.clear();
+	_textures.clear();
+	_vertexBuffers.clear();
+	_indexBuffers.clear();
+	_shortIndexBuffers.clear();
+	_templateDraws.clear();
+}
+
+void CommandList::execute(Renderer& renderer) const {
+	for (const Command& command : _commands) {
+		switch (command.type) {
+			case setVertexShaderCommand:
+				renderer.setVertexShader(_vertexShaders[command.resource]);
+				break;
+			case setPixelShaderCommand:
+				renderer.setPixelShader(_pixelShaders[command.resource]);
+				break;
+			case setTextureCommand:
+				renderer.setTexture(_textures[command.resource]);
+				break;
+			case setVertexBufferCommand:
+				_vertexBuffers[command.resource](renderer);
+				break;
+			case setIndexBufferCommand:
+				renderer.setIndexBuffer(_indexBuffers[command.resource]);
+				break;
+			case setShortIndexBufferCommand:
+				renderer.setIndexBuffer(_shortIndexBuffers[command.resource]);
+				break;
+			case setTopologyCommand:
+				renderer.setPrimitiveTopology(static_cast<PrimitiveTopology>(command.first));
+				break;
+			case primitiveRestartCommand:
+				if (command.first) {
+					renderer.enablePrimitiveRestart(command.count);
+				}
+				else {
+					renderer.disablePrimitiveRestart();
+				}
+				break;
+			case depthTestingCommand:
+				if (command.first) {
+					renderer.enableDepthTesting();
+				}
+				else {
+					renderer.disableDepthTesting();
+				}
+				break;
+			case cullingCommand:
+				if (command.first) {
+					renderer.enableCulling();
+				}
+				else {
+					renderer.disableCulling();
+				}
+				break;
+			case perspectiveCorrectionCommand:
+				if (command.first) {
+					renderer.enablePerspectiveCorrection();
+				}
+				else {
+					renderer.disablePerspectiveCorrection();
+				}
+				break;
+			case drawTrianglesCommand:
+				renderer.drawTriangles(command.first, command.count);
+				break;
+			case drawLinesCommand:
+				renderer.drawLines(command.first, command.count);
+				break;
+			case drawTemplateCommand:
+				_templateDraws[command.resource](renderer);
+				break;
+		}
+	}
+}
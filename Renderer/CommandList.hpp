@@ -0,0 +1,103 @@
+#ifndef CommandList_hpp
+#define CommandList_hpp
+
+#include <cstdint>
+#include <functional>
+#include <vector>
+#include "Renderer.hpp"
+
+namespace renderlib {
+
+	// Records state changes and draws for Renderer::execute. A list is only touched by the thread recording it,
+	// so several lists can be recorded in parallel and executed one after another in submission order.
+	class CommandList {
+	public:
+		void setVertexShader(std::function<Vertex (const Vertex& vertex)> vertexShader);
+		void setPixelShader(std::function<vec4 (const Vertex& fragment)> pixelShader);
+		void setTexture(const TextureHandle& texture);
+		// vertex buffers of any vertex type, the list keeps a reference like the renderer does
+		template <typename InputVertex>
+		void setVertexBuffer(const std::shared_ptr<const std::vector<InputVertex>>& vertexBuffer);
+		void setIndexBuffer(const IndexBufferHandle& indexBuffer);
+		void setIndexBuffer(const ShortIndexBufferHandle& indexBuffer);
+		void setPrimitiveTopology(PrimitiveTopology topology) { record(setTopologyCommand, topology); }
+		void enablePrimitiveRestart(uint32_t restartIndex) { record(primitiveRestartCommand, true, restartIndex); }
+		void disablePrimitiveRestart(void) { record(primitiveRestartCommand, false); }
+		void enableDepthTesting(void) { record(depthTestingCommand, true); }
+		void disableDepthTesting(void) { record(depthTestingCommand, false); }
+		void enableCulling(void) { record(cullingCommand, true); }
+		void disableCulling(void) { record(cullingCommand, false); }
+		void enablePerspectiveCorrection(void) { record(perspectiveCorrectionCommand, true); }
+		void disablePerspectiveCorrection(void) { record(perspectiveCorrectionCommand, false); }
+		void drawTriangles(uint32_t firstVertexIndex, uint32_t count) { record(drawTrianglesCommand, firstVertexIndex, count); }
+		void drawLines(uint32_t firstVertexIndex, uint32_t count) { record(drawLinesCommand, firstVertexIndex, count); }
+		// keeps copies of the shaders, they run through the compile time pipeline when the list is executed
+		template <typename VertexShader, typename PixelShader>
+		void drawTriangles(uint32_t firstVertexIndex, uint32_t count, const VertexShader& vertexShader, const PixelShader& pixelShader);
+		// appends the commands of another list, merged lists replay in the order they were appended. A list
+		// appended to itself replays its commands twice.
+		void append(const CommandList& commandList);
+		void clear(void);
+		bool empty(void) const { return _commands.empty(); }
+		void execute(Renderer& renderer) const;
+	private:
+		enum CommandType {
+			setVertexShaderCommand,
+			setPixelShaderCommand,
+			setTextureCommand,
+			setVertexBufferCommand,
+			setIndexBufferCommand,
+			setShortIndexBufferCommand,
+			setTopologyCommand,
+			primitiveRestartCommand,
+			depthTestingCommand,
+			cullingCommand,
+			perspectiveCorrectionCommand,
+			drawTrianglesCommand,
+			drawLinesCommand,
+			drawTemplateCommand
+		};
+		// first and count hold the arguments of draws and toggles, count the index of primitive restart. resource
+		// indexes the table of the command type.
+		struct Command {
+			CommandType type;
+			uint32_t first;
+			uint32_t count;
+			uint32_t resource;
+		};
+		void record(CommandType type, uint32_t first, uint32_t count = 0, uint32_t resource = 0) { _commands.push_back({type, first, count, resource}); }
+		template <typename Resource>
+		static uint32_t store(std::vector<Resource>& table, const Resource& resource);
+		std::vector<Command> _commands;
+		std::vector<std::function<Vertex (const Vertex& vertex)>> _vertexShaders;
+		std::vector<std::function<vec4 (const Vertex& fragment)>> _pixelShaders;
+		std::vector<TextureHandle> _textures;
+		std::vector<std::function<void (Renderer& renderer)>> _vertexBuffers;
+		std::vector<IndexBufferHandle> _indexBuffers;
+		std::vector<ShortIndexBufferHandle> _shortIndexBuffers;
+		std::vector<std::function<void (Renderer& renderer)>> _templateDraws;
+	};
+
+	template <typename InputVertex>
+	void CommandList::setVertexBuffer(const std::shared_ptr<const std::vector<InputVertex>>& vertexBuffer) {
+		record(setVertexBufferCommand, 0, 0, store(_vertexBuffers, std::function<void (Renderer& renderer)>([vertexBuffer](Renderer& renderer) {
+			renderer.setVertexBuffer(vertexBuffer);
+		})));
+	}
+
+	template <typename VertexShader, typename PixelShader>
+	void CommandList::drawTriangles(uint32_t firstVertexIndex, uint32_t count, const VertexShader& vertexShader, const PixelShader& pixelShader) {
+		const uint32_t draw = store(_templateDraws, std::function<void (Renderer& renderer)>([=](Renderer& renderer) {
+			renderer.drawTriangles(firstVertexIndex, count, vertexShader, pixelShader);
+		}));
+		record(drawTemplateCommand, 0, 0, draw);
+	}
+
+	template <typename Resource>
+	uint32_t CommandList::store(std::vector<Resource>& table, const Resource& resource) {
+		table.push_back(resource);
+		return static_cast<uint32_t>(table.size() - 1);
+	}
+}
+
+#endif /* CommandList_hpp */
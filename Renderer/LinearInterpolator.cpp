@@ -1 +0,0 @@
-#include "LinearInterpolator.hpp"
@@ -0,0 +1,777 @@
+#ifndef Pipeline_hpp
+#define Pipeline_hpp
+
+// Definitions of the Renderer member templates. The shaders are template parameters, so functors and lambdas are
+// inlined into the vertex loop and the span loops, and the vertex layout passed between them sizes the stage
+// buffers and the interpolation.
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <limits>
+#include <type_traits>
+#include <glm/simd/common.h>
+
+namespace renderlib {
+
+	// the vertex type a vertex shader takes and the vertex layout it returns, read from its call operator.
+	// Instanced vertex shaders take the instance as a second argument.
+	template <typename VertexShader>
+	struct VertexShaderTraits : VertexShaderTraits<decltype(&VertexShader::operator())> {
+	};
+
+	template <typename Output, typename Input, typename... Instance>
+	struct VertexShaderTraits<Output (Input, Instance...)> {
+		typedef typename std::decay<Input>::type InputVertex;
+		typedef typename std::decay<Output>::type Varyings;
+	};
+
+	template <typename Output, typename Input, typename... Instance>
+	struct VertexShaderTraits<Output (*)(Input, Instance...)> : VertexShaderTraits<Output (Input, Instance...)> {
+	};
+
+	template <typename Shader, typename Output, typename Input, typename... Instance>
+	struct VertexShaderTraits<Output (Shader::*)(Input, Instance...)> : VertexShaderTraits<Output (Input, Instance...)> {
+	};
+
+	template <typename Shader, typename Output, typename Input, typename... Instance>
+	struct VertexShaderTraits<Output (Shader::*)(Input, Instance...) const> : VertexShaderTraits<Output (Input, Instance...)> {
+	};
+
+	template <typename PixelShader>
+	struct PixelShaderTraits {
+		static const bool writesColor = true;
+	};
+
+	// stand-ins for pixel shaders that only consume the window position
+	template <>
+	struct PixelShaderTraits<VisibilityWriter> {
+		static const bool writesColor = false;
+	};
+
+	template <>
+	struct PixelShaderTraits<DepthOnlyWriter> {
+		static const bool writesColor = false;
+	};
+
+	// leading floats of a vertex layout that are interpolated for a pixel shader, the stand-ins only need x, y and z
+	template <typename Varyings, typename PixelShader>
+	struct InterpolatedFloats {
+		static const int count = PixelShaderTraits<PixelShader>::writesColor ? VertexLayout<Varyings>::floatCount : 3;
+	};
+
+	template <typename PixelShader, typename Varyings>
+	inline void stepFragment(Varyings& fragment, const Varyings& gradient) {
+		float* value = VertexLayout<Varyings>::floats(fragment);
+		const float* step = VertexLayout<Varyings>::floats(gradient);
+		UnrolledLoop<0, InterpolatedFloats<Varyings, PixelShader>::count>::run([&](int i) {
+			value[i] += step[i];
+		});
+	}
+
+	// interpolation in screen space is done with the varyings divided by w
+	template <typename Varyings>
+	inline Varyings perspectiveCorrected(const Varyings& fragment) {
+		typedef VertexLayout<Varyings> Layout;
+		Varyings corrected = fragment;
+		float* value = Layout::floats(corrected);
+		const float w = fragment.position.w;
+		UnrolledLoop<4, Layout::floatCount>::run([&](int i) {
+			value[i] /= w;
+		});
+		return corrected;
+	}
+
+	template <typename InputVertex>
+	void Renderer::setVertexBuffer(const std::shared_ptr<const vector<InputVertex>>& vertexBuffer) {
+		_vertexBuffer = vertexBuffer;
+		_vertexData = vertexBuffer->data();
+		_vertexCount = vertexBuffer->size();
+		_vertexBufferLayout = layoutId<InputVertex>();
+		// binding a buffer of the same size every frame leaves the per vertex stage buffers as they are
+		_clipOutcodes.resize(_vertexCount);
+		_clipVertexGenerations.resize(_vertexCount);
+	}
+
+	template <typename Varyings>
+	Renderer::LayoutStorage<Varyings>& Renderer::layoutStorage(void) {
+		const uint32_t layout = layoutId<Varyings>();
+		if (layout >= _layoutStorage.size()) {
+			_layoutStorage.resize(layout + 1);
+		}
+		if (!_layoutStorage[layout]) {
+			_layoutStorage[layout].reset(new LayoutStorage<Varyings>());
+		}
+		return static_cast<LayoutStorage<Varyings>&>(*_layoutStorage[layout]);
+	}
+
+	template <typename VertexShader, typename PixelShader>
+	void Renderer::drawTriangles(uint32_t firstVertexIndex, uint32_t count, const VertexShader& vertexShader, const PixelShader& pixelShader) {
+		typedef typename VertexShaderTraits<VertexShader>::Varyings Varyings;
+		if (!isVertexBufferOf<typename VertexShaderTraits<VertexShader>::InputVertex>()) {
+			return;
+		}
+		if (_shouldSortDraws && !_shouldPerformDepthTest) {
+			// without depth test the order of draws is visible, so the queued draws go first
+			flushQueuedDraws();
+		}
+		processVertexes(firstVertexIndex, _topology == triangleList ? count*3 : count, restartsTriangles(), vertexShader);
+		collectTriangleIndices(firstVertexIndex, count);
+		layoutStorage<Varyings>().assembledTriangles.clear();
+		assembleTriangles<Varyings>();
+		submitDraw<Varyings>(pixelShader);
+	}
+
+	template <typename VertexShader, typename PixelShader>
+	void Renderer::drawTrianglesInstanced(uint32_t firstVertexIndex, uint32_t count, uint32_t instanceCount, const VertexShader& vertexShader, const PixelShader& pixelShader) {
+		typedef VertexShaderTraits<VertexShader> Traits;
+		typedef typename Traits::Varyings Varyings;
+		if (!isVertexBufferOf<typename Traits::InputVertex>()) {
+			return;
+		}
+		if (_shouldSortDraws && !_shouldPerformDepthTest) {
+			flushQueuedDraws();
+		}
+		// the indices are read once for all instances, every instance shades the collected vertices again and adds
+		// its triangles to a single submission, so binning and state setup happen once for the whole draw
+		collectDrawVertexes(firstVertexIndex, _topology == triangleList ? count*3 : count, restartsTriangles());
+		collectTriangleIndices(firstVertexIndex, count);
+		layoutStorage<Varyings>().assembledTriangles.clear();
+		for (uint32_t instance = 0; instance < instanceCount; ++instance) {
+			shadeDrawVertexes([&](const typename Traits::InputVertex& vertex) -> Varyings {
+				return vertexShader(vertex, instance);
+			});
+			assembleTriangles<Varyings>();
+		}
+		submitDraw<Varyings>(pixelShader);
+	}
+
+	template <typename Varyings, typename PixelShader>
+	void Renderer::submitDraw(const PixelShader& pixelShader) {
+		if (_shouldSortDraws && _shouldPerformDepthTest) {
+			queueDraw<Varyings>(pixelShader);
+		}
+		else {
+			submitTriangles<Varyings>(pixelShader);
+		}
+	}
+
+	template <typename VertexShader>
+	void Renderer::drawLines(uint32_t firstVertexIndex, uint32_t count, const VertexShader& vertexShader) {
+		if (!isVertexBufferOf<typename VertexShaderTraits<VertexShader>::InputVertex>()) {
+			return;
+		}
+		// lines are drawn right away, so queued triangles before them are submitted first
+		if (!_queuedDraws.empty()) {
+			flushQueuedDraws();
+		}
+		processVertexes(firstVertexIndex, count*2, false, vertexShader);
+		rasterizeLines<typename VertexShaderTraits<VertexShader>::Varyings>(firstVertexIndex, count);
+	}
+
+	template <typename Varyings, typename PixelShader>
+	void Renderer::submitTriangles(const PixelShader& pixelShader) {
+		if (_shouldDeferShading && PixelShaderTraits<PixelShader>::writesColor) {
+			// only depth and triangle ids are rasterized now, render() runs the pixel shader once per visible pixel
+			const uint32_t firstTriangleId = static_cast<uint32_t>(_deferredTriangleDraws.size()) + 1;
+			deferPixelShader<Varyings>(pixelShader);
+			rasterizeTriangles<Varyings>(selectTriangleRasterizer<Varyings, VisibilityWriter>(), [&](uint32_t triangle) {
+				return VisibilityWriter{firstTriangleId + triangle};
+			});
+		}
+		else {
+			// depth test and perspective correction are resolved here instead of for every fragment
+			rasterizeTriangles<Varyings>(selectTriangleRasterizer<Varyings, PixelShader>(), [&](uint32_t) -> const PixelShader& {
+				return pixelShader;
+			});
+		}
+	}
+
+	template <typename Varyings, typename PixelShader>
+	void Renderer::queueDraw(const PixelShader& pixelShader) {
+		LayoutStorage<Varyings>& storage = layoutStorage<Varyings>();
+		if (storage.assembledTriangles.empty()) {
+			return;
+		}
+		// the nearest vertex after clipping orders the draw, the triangles are kept since the vertex buffers
+		// may change before the queue is submitted
+		float nearestDepth = std::numeric_limits<float>::max();
+		for (const AssembledTriangle<Varyings>& triangle : storage.assembledTriangles) {
+			nearestDepth = std::min({nearestDepth, triangle.verts[0].position.z, triangle.verts[1].position.z, triangle.verts[2].position.z});
+		}
+		const size_t firstTriangle = storage.queuedTriangles.size();
+		const size_t triangleCount = storage.assembledTriangles.size();
+		storage.queuedTriangles.insert(storage.queuedTriangles.end(), storage.assembledTriangles.begin(), storage.assembledTriangles.end());
+		_queuedDraws.push_back({nearestDepth, drawStateKey<Varyings, PixelShader>(), drawState(), [this, &storage, firstTriangle, triangleCount, pixelShader]() {
+			storage.assembledTriangles.assign(storage.queuedTriangles.begin() + firstTriangle, storage.queuedTriangles.begin() + firstTriangle + triangleCount);
+			submitTriangles<Varyings>(pixelShader);
+		}});
+	}
+
+	template <typename VertexShader>
+	void Renderer::processVertexes(uint32_t firstIndex, uint32_t indexCount, bool skipRestartIndex, const VertexShader& vertexShader) {
+		collectDrawVertexes(firstIndex, indexCount, skipRestartIndex);
+		shadeDrawVertexes(vertexShader);
+	}
+
+	template <typename VertexShader>
+	void Renderer::shadeDrawVertexes(const VertexShader& vertexShader) {
+		typedef typename VertexShaderTraits<VertexShader>::InputVertex InputVertex;
+		typedef typename VertexShaderTraits<VertexShader>::Varyings Varyings;
+		// the draw calls have checked that the vertex shader takes the vertex type of the bound buffer
+		assert(isVertexBufferOf<InputVertex>());
+		const InputVertex* vertexBuffer = static_cast<const InputVertex*>(_vertexData);
+		LayoutStorage<Varyings>& storage = layoutStorage<Varyings>();
+		storage.clipVertexes.resize(_vertexCount);
+		storage.windowVertexes.resize(_vertexCount);
+		// the referenced vertices are shaded in batches, each followed by the fused divide and viewport transform
+		const unsigned int batchSize = 256;
+		const unsigned int batchCount = static_cast<unsigned int>((_drawVertexIndices.size() + batchSize - 1) / batchSize);
+		auto processBatch = [&](unsigned int batch) {
+			const uint32_t* indices = _drawVertexIndices.data() + batch*batchSize;
+			const unsigned int count = std::min(batchSize, static_cast<unsigned int>(_drawVertexIndices.size()) - batch*batchSize);
+			for (unsigned int i = 0; i < count; ++i) {
+				storage.clipVertexes[indices[i]] = vertexShader(vertexBuffer[indices[i]]);
+			}
+			transformToWindow(storage, indices, count);
+		};
+		if (_threadPool && batchCount > 1) {
+			_threadPool->parallelFor(batchCount, processBatch);
+		}
+		else {
+			for (unsigned int batch = 0; batch < batchCount; ++batch) {
+				processBatch(batch);
+			}
+		}
+	}
+
+	template <typename Varyings>
+	void Renderer::transformToWindow(LayoutStorage<Varyings>& storage, const uint32_t* indices, unsigned int count) {
+		unsigned int i = 0;
+#if GLM_ARCH & GLM_ARCH_SSE2_BIT
+		// four positions are transposed into x, y, z and w registers, which yields the outcodes, the perspective
+		// divide and the viewport transform for all of them at once. The results match windowVertex exactly.
+		const float halfWidth = (static_cast<float>(_width) - 1)/2;
+		const float halfHeight = (static_cast<float>(_height) - 1)/2;
+		const glm_vec4 scaleX = _mm_set1_ps(halfWidth), offsetX = _mm_set1_ps(static_cast<float>(_x) + halfWidth);
+		const glm_vec4 scaleY = _mm_set1_ps(halfHeight), offsetY = _mm_set1_ps(static_cast<float>(_y) + halfHeight);
+		const glm_vec4 scaleZ = _mm_set1_ps((_farZ - _nearZ)/2), offsetZ = _mm_set1_ps((_farZ + _nearZ)/2);
+		const glm_vec4 zero = _mm_setzero_ps(), one = _mm_set1_ps(1.f);
+		for (; i + 4 <= count; i += 4) {
+			glm_vec4 x = _mm_loadu_ps(&storage.clipVertexes[indices[i]].position.x);
+			glm_vec4 y = _mm_loadu_ps(&storage.clipVertexes[indices[i+1]].position.x);
+			glm_vec4 z = _mm_loadu_ps(&storage.clipVertexes[indices[i+2]].position.x);
+			glm_vec4 w = _mm_loadu_ps(&storage.clipVertexes[indices[i+3]].position.x);
+			_MM_TRANSPOSE4_PS(x, y, z, w);
+			const glm_vec4 minusW = glm_vec4_sub(zero, w);
+			const int outside[6] = {
+				~_mm_movemask_ps(_mm_cmpge_ps(x, minusW)),
+				~_mm_movemask_ps(_mm_cmple_ps(x, w)),
+				~_mm_movemask_ps(_mm_cmpge_ps(y, minusW)),
+				~_mm_movemask_ps(_mm_cmple_ps(y, w)),
+				~_mm_movemask_ps(_mm_cmpge_ps(z, zero)),
+				~_mm_movemask_ps(_mm_cmple_ps(z, w))
+			};
+			const glm_vec4 oneOverW = _mm_div_ps(one, w);
+			alignas(16) float windowX[4], windowY[4], windowZ[4], inverseW[4];
+			_mm_store_ps(windowX, glm_vec4_add(glm_vec4_mul(glm_vec4_mul(x, oneOverW), scaleX), offsetX));
+			_mm_store_ps(windowY, glm_vec4_add(glm_vec4_mul(glm_vec4_mul(y, oneOverW), scaleY), offsetY));
+			_mm_store_ps(windowZ, glm_vec4_add(glm_vec4_mul(glm_vec4_mul(z, oneOverW), scaleZ), offsetZ));
+			_mm_store_ps(inverseW, oneOverW);
+			for (int lane = 0; lane < 4; ++lane) {
+				const uint32_t index = indices[i+lane];
+				unsigned int outcode = 0;
+				for (int plane = 0; plane < 6; ++plane) {
+					outcode |= ((outside[plane] >> lane) & 1) << plane;
+				}
+				_clipOutcodes[index] = outcode;
+				Varyings& window = storage.windowVertexes[index];
+				window = storage.clipVertexes[index];
+				window.position = {snapToSubpixelGrid(windowX[lane]), snapToSubpixelGrid(windowY[lane]), windowZ[lane], inverseW[lane]};
+				if (_shouldPerformPerspectiveCorrection) {
+					scaleVaryings(window, inverseW[lane]);
+				}
+			}
+		}
+#endif
+		for (; i < count; ++i) {
+			_clipOutcodes[indices[i]] = clipOutcode(storage.clipVertexes[indices[i]].position);
+			storage.windowVertexes[indices[i]] = windowVertex(storage.clipVertexes[indices[i]]);
+		}
+	}
+
+	template <typename Varyings>
+	Varyings Renderer::windowVertex(const Varyings& clipVertex) const {
+		// perspective projection & transform from normalized device coordinates to window coordiates
+		float oneOverW = 1./clipVertex.position.w;
+		Varyings window = clipVertex;
+		window.position = convertNormalizedDeviceCoordateToWindow(clipVertex.position*oneOverW, _x, _y, _width, _height, _nearZ, _farZ);
+		window.position.x = snapToSubpixelGrid(window.position.x);
+		window.position.y = snapToSubpixelGrid(window.position.y);
+		window.position.w = oneOverW;
+		if (_shouldPerformPerspectiveCorrection) {
+			scaleVaryings(window, oneOverW);
+		}
+		return window;
+	}
+
+	template <typename Varyings>
+	void Renderer::assembleTriangles(void) {
+		// primitive assembly and clipping work in fixed size buffers, so no triangle allocates
+		LayoutStorage<Varyings>& storage = layoutStorage<Varyings>();
+		Varyings ndcVertexes[maxClippedVertexCount];
+		for (size_t i = 0; i < _triangleIndices.size(); i += 3) {
+			int vertexCount = assembleTriangle(storage, _triangleIndices[i], _triangleIndices[i+1], _triangleIndices[i+2], ndcVertexes);
+			if (vertexCount < 3) {
+				continue;
+			}
+			if (_shouldPerformCulling && cullFace(ndcVertexes[0].position, ndcVertexes[1].position, ndcVertexes[2].position)) {
+				continue;
+			}
+			// render triangle fan after clipping
+			for (int p = 1; p < vertexCount-1; ++p) {
+				storage.assembledTriangles.push_back({{ndcVertexes[0], ndcVertexes[p], ndcVertexes[p+1]}});
+			}
+		}
+	}
+
+	template <typename Varyings>
+	int Renderer::assembleTriangle(const LayoutStorage<Varyings>& storage, uint32_t first, uint32_t second, uint32_t third, Varyings (&windowVertexes)[maxClippedVertexCount]) {
+		// only triangles crossing a plane reach the clipper, all others use the vertex stage results
+		unsigned int outcode0 = _clipOutcodes[first];
+		unsigned int outcode1 = _clipOutcodes[second];
+		unsigned int outcode2 = _clipOutcodes[third];
+		if ((outcode0 & outcode1 & outcode2) != 0) {
+			return 0;
+		}
+		if ((outcode0 | outcode1 | outcode2) == 0) {
+			windowVertexes[0] = storage.windowVertexes[first];
+			windowVertexes[1] = storage.windowVertexes[second];
+			windowVertexes[2] = storage.windowVertexes[third];
+			return 3;
+		}
+		ClippedPolygon<Varyings> clippedPolygon;
+		clipTriangleToGuardBand({storage.clipVertexes[first], storage.clipVertexes[second], storage.clipVertexes[third]}, guardBand(), clippedPolygon);
+		for (int p = 0; p < clippedPolygon.count; ++p) {
+			windowVertexes[p] = windowVertex(clippedPolygon.verts[p]);
+		}
+		return clippedPolygon.count;
+	}
+
+	template <typename Varyings>
+	int Renderer::binTriangles(void) {
+		const vector<AssembledTriangle<Varyings>>& triangles = layoutStorage<Varyings>().assembledTriangles;
+		const int tilesX = (static_cast<int>(_width) + tileSize - 1) / tileSize;
+		const int tilesY = (static_cast<int>(_height) + tileSize - 1) / tileSize;
+		_tileBins.resize(tilesX*tilesY);
+		for (vector<uint32_t>& bin : _tileBins) {
+			bin.clear();
+		}
+		// sort-middle: every tile gets the triangles whose conservative bounding box overlaps it, in submission order
+		for (uint32_t i = 0; i < triangles.size(); ++i) {
+			const Varyings (&verts)[3] = triangles[i].verts;
+			int minX = std::max(static_cast<int>(floor(std::min({verts[0].position.x, verts[1].position.x, verts[2].position.x}))), 0);
+			int maxX = std::min(static_cast<int>(ceil(std::max({verts[0].position.x, verts[1].position.x, verts[2].position.x}))), static_cast<int>(_width)-1);
+			int minY = std::max(static_cast<int>(floor(std::min({verts[0].position.y, verts[1].position.y, verts[2].position.y}))), 0);
+			int maxY = std::min(static_cast<int>(ceil(std::max({verts[0].position.y, verts[1].position.y, verts[2].position.y}))), static_cast<int>(_height)-1);
+			if (minX > maxX || minY > maxY) {
+				continue;
+			}
+			for (int tileY = minY / tileSize; tileY <= maxY / tileSize; ++tileY) {
+				for (int tileX = minX / tileSize; tileX <= maxX / tileSize; ++tileX) {
+					_tileBins[tileY*tilesX + tileX].push_back(i);
+				}
+			}
+		}
+		return tilesX;
+	}
+
+	template <typename Varyings>
+	void Renderer::rasterizeLines(uint32_t firstVertexIndex, uint32_t count) {
+		if (_shortIndexBuffer) {
+			rasterizeLines<Varyings>(_shortIndexBuffer->data(), firstVertexIndex, count);
+		}
+		else {
+			rasterizeLines<Varyings>(_indexBuffer->data(), firstVertexIndex, count);
+		}
+	}
+
+	template <typename Varyings, typename Index>
+	void Renderer::rasterizeLines(const Index* indices, uint32_t firstVertexIndex, uint32_t count) {
+		const LayoutStorage<Varyings>& storage = layoutStorage<Varyings>();
+		for (uint32_t i = 0; i < count*2; i += 2) {
+			const uint32_t startIndex = indices[firstVertexIndex+i];
+			const uint32_t endIndex = indices[firstVertexIndex+i+1];
+			if (_clipOutcodes[startIndex] & _clipOutcodes[endIndex]) {
+				continue;
+			}
+			const vec4 color = storage.clipVertexes[startIndex].color;
+			const Pixel pixel = {static_cast<uint8_t>(color.r*255), static_cast<uint8_t>(color.g*255), static_cast<uint8_t>(color.b*255), static_cast<uint8_t>(color.a*255)};
+			if ((_clipOutcodes[startIndex] | _clipOutcodes[endIndex]) == 0) {
+				rasterizeLine(storage.windowVertexes[startIndex].position, storage.windowVertexes[endIndex].position, pixel);
+				continue;
+			}
+			Varyings start = storage.clipVertexes[startIndex];
+			Varyings end = storage.clipVertexes[endIndex];
+			if (clipLineToFrustum(start, end)) {
+				rasterizeLine(windowVertex(start).position, windowVertex(end).position, pixel);
+			}
+		}
+	}
+
+	template <typename Varyings, typename PixelShader>
+	uint64_t Renderer::drawStateKey(void) {
+		// every pixel shader and vertex layout pair gets an id the first time it is queued, the render state picks its instantiation
+		static const uint32_t pipelineId = nextPipelineId();
+		const uint32_t stateBits = (_shouldPerformDepthTest ? 1 : 0) | (_shouldPerformPerspectiveCorrection ? 2 : 0) | (_shouldDeferShading ? 4 : 0) | (_rasterizer << 3);
+		const uint32_t textureId = _queuedTextures.insert({_texture.get(), static_cast<uint32_t>(_queuedTextures.size())}).first->second;
+		return (static_cast<uint64_t>((pipelineId << 4) | stateBits) << 32) | textureId;
+	}
+
+	template <typename Varyings, typename PixelShader, typename ShaderForTriangle>
+	void Renderer::rasterizeTriangles(TriangleRasterizer<Varyings, PixelShader> rasterizeTriangle, const ShaderForTriangle& shaderForTriangle) {
+		const vector<AssembledTriangle<Varyings>>& triangles = layoutStorage<Varyings>().assembledTriangles;
+		if (!_threadPool) {
+			const PixelRect viewportRect = {0, 0, static_cast<int>(_width)-1, static_cast<int>(_height)-1};
+			for (uint32_t i = 0; i < triangles.size(); ++i) {
+				(this->*rasterizeTriangle)(triangles[i].verts, viewportRect, shaderForTriangle(i));
+			}
+			return;
+		}
+		const int tilesX = binTriangles<Varyings>();
+		// tiles cover disjoint pixels, so workers never touch the same color or depth value
+		_threadPool->parallelFor(static_cast<unsigned int>(_tileBins.size()), [&](unsigned int tile) {
+			const vector<uint32_t>& bin = _tileBins[tile];
+			if (bin.empty()) {
+				return;
+			}
+			const int tileX = (tile % tilesX) * tileSize;
+			const int tileY = (tile / tilesX) * tileSize;
+			const PixelRect tileRect = {tileX, tileY, std::min(tileX + tileSize, static_cast<int>(_width))-1, std::min(tileY + tileSize, static_cast<int>(_height))-1};
+			for (uint32_t index : bin) {
+				(this->*rasterizeTriangle)(triangles[index].verts, tileRect, shaderForTriangle(index));
+			}
+		});
+	}
+
+	template <typename Varyings, typename PixelShader>
+	void Renderer::deferPixelShader(const PixelShader& pixelShader) {
+		LayoutStorage<Varyings>& storage = layoutStorage<Varyings>();
+		const uint32_t drawIndex = static_cast<uint32_t>(_deferredDraws.size());
+		const uint32_t firstTriangleId = static_cast<uint32_t>(_deferredTriangleDraws.size()) + 1;
+		const size_t firstPlanes = storage.deferredPlanes.size();
+		for (const AssembledTriangle<Varyings>& triangle : storage.assembledTriangles) {
+			storage.deferredPlanes.push_back(setupAttributePlanes(triangle.verts[0], triangle.verts[1], triangle.verts[2]));
+			_deferredTriangleDraws.push_back(drawIndex);
+		}
+		if (_visibilityBuffer.size() != _width*_height) {
+			_visibilityBuffer.assign(_width*_height, 0);
+		}
+		// the resolver keeps a copy of the shader, the visible pixels are shaded with the state of this draw
+		if (_shouldPerformPerspectiveCorrection) {
+			_deferredDraws.push_back({drawState(), [this, &storage, firstPlanes, firstTriangleId, pixelShader](const uint32_t* pixels, size_t count) {
+				shadeDeferredPixels<FragmentState<false, true>>(pixels, count, storage.deferredPlanes.data() + firstPlanes, firstTriangleId, pixelShader);
+			}});
+		}
+		else {
+			_deferredDraws.push_back({drawState(), [this, &storage, firstPlanes, firstTriangleId, pixelShader](const uint32_t* pixels, size_t count) {
+				shadeDeferredPixels<FragmentState<false, false>>(pixels, count, storage.deferredPlanes.data() + firstPlanes, firstTriangleId, pixelShader);
+			}});
+		}
+	}
+
+	template <typename State, typename Varyings, typename PixelShader>
+	void Renderer::shadeDeferredPixels(const uint32_t* pixels, size_t count, const AttributePlanes<Varyings>* planes, uint32_t firstTriangleId, const PixelShader& pixelShader) {
+		for (size_t i = 0; i < count; ++i) {
+			const int x = pixels[i] % _width;
+			const int y = pixels[i] / _width;
+			const AttributePlanes<Varyings>& triangle = planes[_visibilityBuffer[pixels[i]] - firstTriangleId];
+			writeFragment<State>(x, y, evaluateAttributePlanes(triangle, x, y), pixelShader);
+		}
+	}
+
+	template <typename Varyings, typename PixelShader>
+	Renderer::TriangleRasterizer<Varyings, PixelShader> Renderer::selectTriangleRasterizer(void) const {
+		// one instantiation per rasterizer and fragment state, indexed by the current render state
+		static const TriangleRasterizer<Varyings, PixelShader> rasterizers[2][2][2] = {
+			{
+				{&Renderer::rasterizeTriangleScanline<FragmentState<false, false>>, &Renderer::rasterizeTriangleScanline<FragmentState<false, true>>},
+				{&Renderer::rasterizeTriangleScanline<FragmentState<true, false>>, &Renderer::rasterizeTriangleScanline<FragmentState<true, true>>}
+			},
+			{
+				{&Renderer::rasterizeTriangleHalfSpace<FragmentState<false, false>>, &Renderer::rasterizeTriangleHalfSpace<FragmentState<false, true>>},
+				{&Renderer::rasterizeTriangleHalfSpace<FragmentState<true, false>>, &Renderer::rasterizeTriangleHalfSpace<FragmentState<true, true>>}
+			}
+		};
+		return rasterizers[_rasterizer][_shouldPerformDepthTest][_shouldPerformPerspectiveCorrection];
+	}
+
+	template <typename State, typename Varyings, typename PixelShader>
+	void Renderer::rasterizeTriangleScanline(const Varyings (&verts)[3], const PixelRect& clipRect, const PixelShader& pixelShader) {
+		if (edgeFunction(verts[0].position, verts[1].position, vec2(verts[2].position)) == 0) {
+			return;
+		}
+		triangle t = triangleFromVerts(verts);
+		const AttributePlanes<Varyings> planes = setupAttributePlanes(verts[0], verts[1], verts[2]);
+		
+		if (t.leftAndRightOnTop) {
+			edgeLoop<State>(verts[t.topIndex], verts[t.midIndex], verts[t.bottomIndex], verts[t.bottomIndex], t.heightOfC, planes, clipRect, pixelShader);
+			return;
+		}
+		Varyings vOnC = clipVertex(verts[t.topIndex], verts[t.bottomIndex], ((float)t.heightOfA)/t.heightOfC);
+		edgeLoop<State>(verts[t.topIndex], verts[t.topIndex], t.leftSideIsC ? vOnC : verts[t.midIndex], t.leftSideIsC ? verts[t.midIndex] : vOnC, t.heightOfA, planes, clipRect, pixelShader);
+		edgeLoop<State>(t.leftSideIsC ? vOnC : verts[t.midIndex], t.leftSideIsC ? verts[t.midIndex] : vOnC, verts[t.bottomIndex], verts[t.bottomIndex], t.heightOfB, planes, clipRect, pixelShader);
+	}
+
+	template <typename State, typename Varyings, typename PixelShader>
+	void Renderer::rasterizeTriangleHalfSpace(const Varyings (&verts)[3], const PixelRect& clipRect, const PixelShader& pixelShader) {
+		// bring the triangle into counter-clockwise order, so the interior lies on the positive side of all edges
+		const Varyings* v0 = &verts[0];
+		const Varyings* v1 = &verts[1];
+		const Varyings* v2 = &verts[2];
+		ivec2 f0 = toFixedPoint(v0->position);
+		ivec2 f1 = toFixedPoint(v1->position);
+		ivec2 f2 = toFixedPoint(v2->position);
+		int64_t area = fixedPointArea(f0, f1, f2);
+		if (area == 0) {
+			return;
+		}
+		if (area < 0) {
+			std::swap(v1, v2);
+			std::swap(f1, f2);
+			area = -area;
+		}
+
+		// pixels are sampled at integer window coordinates, restricted to the bounding box of the triangle
+		int minX = std::max((std::min({f0.x, f1.x, f2.x}) + subpixelSteps - 1) >> subpixelBits, clipRect.minX);
+		int maxX = std::min(std::max({f0.x, f1.x, f2.x}) >> subpixelBits, clipRect.maxX);
+		int minY = std::max((std::min({f0.y, f1.y, f2.y}) + subpixelSteps - 1) >> subpixelBits, clipRect.minY);
+		int maxY = std::min(std::max({f0.y, f1.y, f2.y}) >> subpixelBits, clipRect.maxY);
+		if (minX > maxX || minY > maxY) {
+			return;
+		}
+
+		// edge i is opposite to vertex i, coverage is decided in exact integer arithmetic
+		const int originX = minX & ~(blockSize - 1);
+		const int originY = minY & ~(blockSize - 1);
+		const FixedPointEdge e0 = setupFixedPointEdge(f1, f2, originX, originY);
+		const FixedPointEdge e1 = setupFixedPointEdge(f2, f0, originX, originY);
+		const FixedPointEdge e2 = setupFixedPointEdge(f0, f1, originX, originY);
+		const EdgeBlockBounds bounds0 = edgeBlockBounds(e0, blockSize);
+		const EdgeBlockBounds bounds1 = edgeBlockBounds(e1, blockSize);
+		const EdgeBlockBounds bounds2 = edgeBlockBounds(e2, blockSize);
+		// attributes are evaluated at the left column of every block and stepped from there, blocks are aligned
+		// to the window, so a triangle yields the same values whether it is rasterized at once or tile by tile
+		const AttributePlanes<Varyings> planes = setupAttributePlanes(*v0, *v1, *v2);
+		// stepped depth values may round slightly below the plane, so hierarchical z only rejects with a margin
+		const float nearestDepth = std::min({v0->position.z, v1->position.z, v2->position.z}) - 1e-6f;
+
+#if GLM_ARCH & GLM_ARCH_SSE2_BIT
+		// pixels inside a block are visited in 2x2 quads, lanes are ordered (x, y), (x+1, y), (x, y+1), (x+1, y+1).
+		// Coverage, depth and the interpolated attributes are evaluated for all four pixels at once.
+		typedef VertexLayout<Varyings> Layout;
+		const int attributeCount = InterpolatedFloats<Varyings, PixelShader>::count;
+		const float* gradientX = Layout::floats(planes.gradientX);
+		const float* gradientY = Layout::floats(planes.gradientY);
+		glm_vec4 laneOffset[attributeCount];
+		glm_vec4 quadStep[attributeCount];
+		for (int a = 0; a < attributeCount; ++a) {
+			laneOffset[a] = _mm_set_ps(gradientX[a] + gradientY[a], gradientY[a], gradientX[a], 0.f);
+			quadStep[a] = _mm_set1_ps(2*gradientX[a]);
+		}
+		const glm_ivec4 edgeOffset0 = _mm_set_epi32(e0.stepX + e0.stepY, e0.stepY, e0.stepX, 0);
+		const glm_ivec4 edgeOffset1 = _mm_set_epi32(e1.stepX + e1.stepY, e1.stepY, e1.stepX, 0);
+		const glm_ivec4 edgeOffset2 = _mm_set_epi32(e2.stepX + e2.stepY, e2.stepY, e2.stepX, 0);
+		const glm_ivec4 edgeStep0 = _mm_set1_epi32(2*e0.stepX);
+		const glm_ivec4 edgeStep1 = _mm_set1_epi32(2*e1.stepX);
+		const glm_ivec4 edgeStep2 = _mm_set1_epi32(2*e2.stepX);
+#endif
+
+		int32_t blockRow0 = e0.value, blockRow1 = e1.value, blockRow2 = e2.value;
+		for (int blockY = originY; blockY <= maxY; blockY += blockSize) {
+			int32_t block0 = blockRow0, block1 = blockRow1, block2 = blockRow2;
+			blockRow0 += blockSize*e0.stepY;
+			blockRow1 += blockSize*e1.stepY;
+			blockRow2 += blockSize*e2.stepY;
+			for (int blockX = originX; blockX <= maxX; blockX += blockSize) {
+				const int32_t b0 = block0, b1 = block1, b2 = block2;
+				block0 += blockSize*e0.stepX;
+				block1 += blockSize*e1.stepX;
+				block2 += blockSize*e2.stepX;
+				// skip blocks completely outside of one edge, blocks inside all edges need no coverage test
+				if (b0 + bounds0.maximum < 0 || b1 + bounds1.maximum < 0 || b2 + bounds2.maximum < 0) {
+					continue;
+				}
+				// hierarchical z: skip blocks where the nearest depth of the triangle is behind every stored depth
+				if (State::shouldPerformDepthTest && std::max(minimumBlockDepth(planes, blockX, blockY, blockSize) - 1e-6f, nearestDepth) > blockMaxDepth(blockX, blockY)) {
+					continue;
+				}
+				const bool blockCovered = ((b0 + bounds0.minimum) | (b1 + bounds1.minimum) | (b2 + bounds2.minimum)) >= 0;
+				bool hasWrittenDepth = false;
+				const int blockMaxX = std::min(blockX + blockSize - 1, maxX);
+				const int blockMaxY = std::min(blockY + blockSize - 1, maxY);
+#if GLM_ARCH & GLM_ARCH_SSE2_BIT
+				const int quadMinX = std::max(blockX, minX & ~1);
+				const int quadMinY = std::max(blockY, minY & ~1);
+				for (int y = quadMinY; y <= blockMaxY; y += 2) {
+					const int rowMask = (y >= minY ? 0x3 : 0) | (y + 1 <= maxY ? 0xc : 0);
+					const int32_t rowOffsetX = quadMinX - blockX, rowOffsetY = y - blockY;
+					glm_ivec4 quad0 = _mm_add_epi32(_mm_set1_epi32(b0 + rowOffsetX*e0.stepX + rowOffsetY*e0.stepY), edgeOffset0);
+					glm_ivec4 quad1 = _mm_add_epi32(_mm_set1_epi32(b1 + rowOffsetX*e1.stepX + rowOffsetY*e1.stepY), edgeOffset1);
+					glm_ivec4 quad2 = _mm_add_epi32(_mm_set1_epi32(b2 + rowOffsetX*e2.stepX + rowOffsetY*e2.stepY), edgeOffset2);
+					// attributes are only stepped across runs of covered quads, after a gap they are evaluated from
+					// the left column of the block
+					glm_vec4 attribute[attributeCount];
+					int steppedX = blockX - 4;
+					for (int x = quadMinX; x <= blockMaxX; x += 2) {
+						const int columnMask = (x >= minX ? 0x5 : 0) | (x + 1 <= maxX ? 0xa : 0);
+						int coverage = rowMask & columnMask;
+						if (!blockCovered) {
+							// a lane is outside as soon as one of its edge values has the sign bit set
+							const glm_ivec4 w = _mm_or_si128(_mm_or_si128(quad0, quad1), quad2);
+							coverage &= ~_mm_movemask_ps(_mm_castsi128_ps(w));
+							quad0 = _mm_add_epi32(quad0, edgeStep0);
+							quad1 = _mm_add_epi32(quad1, edgeStep1);
+							quad2 = _mm_add_epi32(quad2, edgeStep2);
+						}
+						if (coverage == 0) {
+							continue;
+						}
+						if (steppedX == x - 2) {
+							for (int a = 0; a < attributeCount; ++a) {
+								attribute[a] = glm_vec4_add(attribute[a], quadStep[a]);
+							}
+						}
+						else {
+							const Varyings start = evaluateAttributePlanes(planes, blockX, y);
+							const float* startValue = Layout::floats(start);
+							const glm_vec4 quadIndex = _mm_set1_ps((x - blockX)/2);
+							for (int a = 0; a < attributeCount; ++a) {
+								attribute[a] = glm_vec4_add(glm_vec4_add(_mm_set1_ps(startValue[a]), laneOffset[a]), glm_vec4_mul(quadStep[a], quadIndex));
+							}
+						}
+						steppedX = x;
+						// the stand-ins get zero for the floats they do not interpolate
+						alignas(16) float value[Layout::floatCount][4];
+						if (attributeCount < Layout::floatCount) {
+							std::fill_n(&value[0][0], Layout::floatCount*4, 0.f);
+						}
+						for (int a = 0; a < attributeCount; ++a) {
+							_mm_store_ps(value[a], attribute[a]);
+						}
+						// the perspective divide is done here for all four lanes, so the fragments are written without it
+						if (State::shouldPerformPerspectiveCorrection) {
+							for (int a = 4; a < attributeCount; ++a) {
+								_mm_store_ps(value[a], _mm_div_ps(attribute[a], attribute[3]));
+							}
+						}
+						if (State::shouldPerformDepthTest) {
+							alignas(16) float depth[4] = {0, 0, 0, 0};
+							for (int lane = 0; lane < 4; ++lane) {
+								if (coverage & (1 << lane)) {
+									depth[lane] = _depthBuffer[(y + (lane >> 1))*_width + x + (lane & 1)];
+								}
+							}
+							coverage &= _mm_movemask_ps(_mm_cmpge_ps(_mm_load_ps(depth), attribute[2]));
+							hasWrittenDepth |= coverage != 0;
+							for (int lane = 0; lane < 4; ++lane) {
+								if (coverage & (1 << lane)) {
+									_depthBuffer[(y + (lane >> 1))*_width + x + (lane & 1)] = value[2][lane];
+								}
+							}
+						}
+						for (int lane = 0; lane < 4; ++lane) {
+							if (coverage & (1 << lane)) {
+								Varyings fragment;
+								float* fragmentValue = Layout::floats(fragment);
+								UnrolledLoop<0, Layout::floatCount>::run([&](int a) {
+									fragmentValue[a] = value[a][lane];
+								});
+								writeFragment<FragmentState<State::shouldPerformDepthTest, false>>(x + (lane & 1), y + (lane >> 1), fragment, pixelShader);
+							}
+						}
+					}
+				}
+#else
+				const int pixelMinX = std::max(blockX, minX);
+				const int pixelMinY = std::max(blockY, minY);
+				for (int y = pixelMinY; y <= blockMaxY; ++y) {
+					const int32_t rowOffsetX = pixelMinX - blockX, rowOffsetY = y - blockY;
+					int32_t w0 = b0 + rowOffsetX*e0.stepX + rowOffsetY*e0.stepY;
+					int32_t w1 = b1 + rowOffsetX*e1.stepX + rowOffsetY*e1.stepY;
+					int32_t w2 = b2 + rowOffsetX*e2.stepX + rowOffsetY*e2.stepY;
+					Varyings fragment = evaluateAttributePlanes(planes, pixelMinX, y);
+					for (int x = pixelMinX; x <= blockMaxX; ++x) {
+						if (blockCovered || (w0 | w1 | w2) >= 0) {
+							hasWrittenDepth |= shadeFragment<State>(x, y, fragment, pixelShader);
+						}
+						w0 += e0.stepX;
+						w1 += e1.stepX;
+						w2 += e2.stepX;
+						stepFragment<PixelShader>(fragment, planes.gradientX);
+					}
+				}
+#endif
+				if (State::shouldPerformDepthTest && hasWrittenDepth) {
+					updateBlockMaxDepth(blockX, blockY);
+				}
+			}
+		}
+	}
+
+	template <typename State, typename Varyings, typename PixelShader>
+	void Renderer::edgeLoop(const Varyings& leftStart, const Varyings& rightStart, const Varyings& leftDest, const Varyings&rightDest, int numSteps, const AttributePlanes<Varyings>& planes, const PixelRect& clipRect, const PixelShader& pixelShader) {
+		// only the span ends are walked along the edges, the attributes come from the plane equations
+		for (int i = 0; i < numSteps; ++i) {
+			float a = ((float)i)/numSteps;
+			float leftX = leftStart.position.x*(1.f-a) + leftDest.position.x*a;
+			float rightX = rightStart.position.x*(1.f-a) + rightDest.position.x*a;
+			drawSpan<State>(leftX, rightX, leftStart.position.y - i, planes, clipRect, pixelShader);
+		}
+	}
+
+	template <typename State, typename Varyings, typename PixelShader>
+	void Renderer::drawSpan(float leftX, float rightX, float y, const AttributePlanes<Varyings>& planes, const PixelRect& clipRect, const PixelShader& pixelShader) {
+		if (leftX > rightX) {
+			std::swap(leftX, rightX);
+		}
+		int drawY = floor(y);
+		if (drawY < clipRect.minY || drawY > clipRect.maxY) {
+			return;
+		}
+		int startX = std::max(floor(leftX), 0.f);
+		int width = ceil(rightX) - startX;
+		// only the pixels inside the clip rect are visited, attributes are re-evaluated at every tile column
+		int firstPixel = std::max(clipRect.minX - startX, 0);
+		int lastPixel = std::min(clipRect.maxX + 1 - startX, width);
+		Varyings fragment;
+		for (int i = firstPixel; i < lastPixel; ++i) {
+			int drawX = startX+i;
+			if (i == firstPixel || drawX % tileSize == 0) {
+				fragment = evaluateAttributePlanes(planes, drawX, drawY);
+			}
+			shadeFragment<State>(drawX, drawY, fragment, pixelShader);
+			stepFragment<PixelShader>(fragment, planes.gradientX);
+		}
+	}
+
+	template <typename State, typename Varyings, typename PixelShader>
+	bool Renderer::shadeFragment(int x, int y, const Varyings& fragment, const PixelShader& pixelShader) {
+		if (State::shouldPerformDepthTest && !performDepthTest(x, y, fragment.position.z)) {
+			return false;
+		}
+		writeFragment<State>(x, y, fragment, pixelShader);
+		return true;
+	}
+
+	template <typename State, typename Varyings, typename PixelShader>
+	inline void Renderer::writeFragment(int x, int y, const Varyings& fragment, const PixelShader& pixelShader) {
+		vec4 color = State::shouldPerformPerspectiveCorrection ? pixelShader(perspectiveCorrected(fragment)) : pixelShader(fragment);
+		_buffer.setPixel({static_cast<uint8_t>(color.r*255), static_cast<uint8_t>(color.g*255), static_cast<uint8_t>(color.b*255), static_cast<uint8_t>(color.a*255)}, x, y);
+		if (!_deferredDraws.empty()) {
+			discardDeferredPixel(x, y);
+		}
+	}
+}
+
+#endif /* Pipeline_hpp */
@@ -1,7 +1,8 @@
 #include "Renderer.hpp"
-#include "LinearInterpolator.hpp"
+#include "CommandList.hpp"
 #include <tuple>
 #include <algorithm>
+#include <atomic>
 #include <cassert>
 #undef GLM_LEFT_HANDED
 #include <glm/gtc/matrix_transform.hpp>
@@ -13,7 +14,7 @@ using namespace renderlib;
 using namespace glm;
 using namespace std;
 
-Renderer::Renderer(unsigned int width, unsigned int height) : _x(0), _y(0), _width(width), _height(height), _nearZ(0), _farZ(1), _buffer(width, height), _depthBuffer(width*height), _clearColor({0, 0, 0, 255}), _shouldPerformPerspectiveCorrection(true), _shouldPerformDepthTest(true), _shouldPerformCulling(true) {
+Renderer::Renderer(unsigned int width, unsigned int height) : _x(0), _y(0), _width(width), _height(height), _nearZ(0), _farZ(1), _clearColor({0, 0, 0, 255}), _buffer(width, height), _vertexData(nullptr), _vertexCount(0), _vertexBufferLayout(0), _vertexCacheGeneration(0), _depthBuffer(width*height), _blockMaxDepth(((width + blockSize - 1)/blockSize)*((height + blockSize - 1)/blockSize), std::numeric_limits<float>::max()), _shouldPerformPerspectiveCorrection(true), _shouldPerformDepthTest(true), _shouldPerformCulling(true), _rasterizer(scanline), _topology(triangleList), _shouldRestartPrimitives(false), _restartIndex(0), _guardBand(2), _shouldSortDraws(false), _drawSortOrder(sortByDepth), _shouldDeferShading(false) {
 	
 }
 
@@ -32,6 +33,10 @@ void Renderer::setViewport(unsigned int x, unsigned int y, unsigned int width, u
 	_height = height;
 	_buffer.resize(width, height);
 	_depthBuffer.resize(width*height);
+	_blockMaxDepth.assign(blocksPerRow()*((height + blockSize - 1)/blockSize), std::numeric_limits<float>::max());
+	if (!_visibilityBuffer.empty()) {
+		_visibilityBuffer.assign(width*height, 0);
+	}
 }
 
 void Renderer::setDepthRange(float nearZ, float farZ) {
@@ -51,17 +56,53 @@ void Renderer::setPixelShader(std::function<vec4 (const Vertex& fragment)> pixel
 	_pixelShader = pixelShader;
 }
 
-void Renderer::setVertexBuffer(const vector<Vertex>& vertexBuffer) {
-	_vertexBuffer = vertexBuffer;
-	_clipVertexes.resize(vertexBuffer.size());
-	_ndcVertexes.resize(vertexBuffer.size());
+void Renderer::setInstancedVertexShader(std::function<Vertex (const Vertex& vertex, uint32_t instance)> vertexShader) {
+	_instancedVertexShader = vertexShader;
+}
+
+void Renderer::setThreadCount(unsigned int threadCount) {
+	if (threadCount > 1) {
+		_threadPool.reset(new ThreadPool(threadCount));
+	}
+	else {
+		_threadPool.reset();
+	}
+}
+
+void Renderer::setGuardBand(float guardBand) {
+	_guardBand = guardBand >= 1 ? guardBand : 1;
+}
+
+// edge values reach about 2*subpixelSteps*extent^2 for a triangle spanning extent pixels, which stays in
+// 32 bits up to 8192 pixels, less a block of slack on either side for the block and quad offsets
+float Renderer::maxGuardBand(void) const {
+	const float maxExtent = 8192 - 2*blockSize;
+	return std::max(1.f, maxExtent/std::max({_width, _height, 1u}));
 }
 
 void Renderer::setIndexBuffer(const vector<uint32_t>& indexBuffer) {
+	setIndexBuffer(std::make_shared<const vector<uint32_t>>(indexBuffer));
+}
+
+void Renderer::setIndexBuffer(const vector<uint16_t>& indexBuffer) {
+	setIndexBuffer(std::make_shared<const vector<uint16_t>>(indexBuffer));
+}
+
+void Renderer::setIndexBuffer(const IndexBufferHandle& indexBuffer) {
 	_indexBuffer = indexBuffer;
+	_shortIndexBuffer.reset();
+}
+
+void Renderer::setIndexBuffer(const ShortIndexBufferHandle& indexBuffer) {
+	_shortIndexBuffer = indexBuffer;
+	_indexBuffer.reset();
 }
 
 void Renderer::setTexture(const Texture& texture) {
+	_texture = std::make_shared<const Texture>(texture);
+}
+
+void Renderer::setTexture(const TextureHandle& texture) {
 	_texture = texture;
 }
 
@@ -76,97 +117,270 @@ void Renderer::disablePerspectiveCorrection(void) {
 void Renderer::render(void) {
 	_buffer.fill(_clearColor);
 	std::fill_n(_depthBuffer.begin(), _depthBuffer.size(), 1);
+	std::fill_n(_blockMaxDepth.begin(), _blockMaxDepth.size(), 1);
+	std::fill_n(_visibilityBuffer.begin(), _visibilityBuffer.size(), 0);
 	if (_renderFunction) {
 		_renderFunction(*this);
 	}
+	if (!_queuedDraws.empty()) {
+		flushQueuedDraws();
+	}
+	if (!_deferredDraws.empty()) {
+		resolveDeferredShading();
+	}
 }
 
-vector<Vertex> Renderer::transformAndClipTriangle(int startIndex) {
-	uint32_t first = _indexBuffer[startIndex];
-	uint32_t second = _indexBuffer[startIndex+1];
-	uint32_t third = _indexBuffer[startIndex+2];
-	_clipVertexes[first] = _vertexShader(_vertexBuffer[first]);
-	_clipVertexes[second] = _vertexShader(_vertexBuffer[second]);
-	_clipVertexes[third] = _vertexShader(_vertexBuffer[third]);
-	
-	return clipTriangleToFrustum({_clipVertexes[first], _clipVertexes[second], _clipVertexes[third]});
+void Renderer::execute(const CommandList& commandList) {
+	commandList.execute(*this);
 }
 
-void Renderer::drawTriangles(uint32_t firstVertexIndex, uint32_t count) {
-	for (unsigned int i = 0; i < count*3; i += 3) {
-		// transforming to clip space
-		vector<Vertex> clippedPoly = transformAndClipTriangle(firstVertexIndex+i);
-		
-		if (clippedPoly.size() < 3) {
-			continue;
+void Renderer::execute(const vector<CommandList>& commandLists) {
+	for (const CommandList& commandList : commandLists) {
+		commandList.execute(*this);
+	}
+}
+
+void Renderer::disableDeferredShading(void) {
+	_shouldDeferShading = false;
+	if (_deferredDraws.empty()) {
+		vector<uint32_t>().swap(_visibilityBuffer);
+	}
+}
+
+void Renderer::disableDrawSorting(void) {
+	flushQueuedDraws();
+	_shouldSortDraws = false;
+}
+
+Renderer::DrawState Renderer::drawState(void) const {
+	return {_shouldPerformDepthTest, _shouldPerformPerspectiveCorrection, _shouldDeferShading, _rasterizer, _texture};
+}
+
+void Renderer::setDrawState(const DrawState& state) {
+	_shouldPerformDepthTest = state.depthTest;
+	_shouldPerformPerspectiveCorrection = state.perspectiveCorrection;
+	_shouldDeferShading = state.deferShading;
+	_rasterizer = state.rasterizer;
+	if (_texture != state.texture) {
+		_texture = state.texture;
+	}
+}
+
+uint32_t Renderer::nextPipelineId(void) {
+	static std::atomic<uint32_t> pipelineCount(0);
+	return pipelineCount++;
+}
+
+uint32_t Renderer::nextLayoutId(void) {
+	static std::atomic<uint32_t> layoutCount(0);
+	return layoutCount++;
+}
+
+void Renderer::flushQueuedDraws(void) {
+	// draws with the same sort key keep their submission order
+	if (_drawSortOrder == sortByState) {
+		std::stable_sort(_queuedDraws.begin(), _queuedDraws.end(), [](const QueuedDraw& a, const QueuedDraw& b) {
+			return a.stateKey < b.stateKey || (a.stateKey == b.stateKey && a.nearestDepth < b.nearestDepth);
+		});
+	}
+	else {
+		std::stable_sort(_queuedDraws.begin(), _queuedDraws.end(), [](const QueuedDraw& a, const QueuedDraw& b) {
+			return a.nearestDepth < b.nearestDepth;
+		});
+	}
+	const DrawState currentState = drawState();
+	for (size_t i = 0; i < _queuedDraws.size(); ++i) {
+		const QueuedDraw& draw = _queuedDraws[i];
+		// the state is only switched between draws of different keys
+		if (i == 0 || draw.stateKey != _queuedDraws[i-1].stateKey) {
+			setDrawState(draw.state);
 		}
-		// perspective projection &
-		// transform from normalized device coordinates to window coordiates and render triangle strip after clipping
-		_ndcVertexes.resize(clippedPoly.size());
-		for (int p = 0; p < clippedPoly.size(); ++p) {
-			float oneOverW = 1./clippedPoly[p].position.w;
-			_ndcVertexes[p].position = convertNormalizedDeviceCoordateToWindow(clippedPoly[p].position*oneOverW, _x, _y, _width, _height, _nearZ, _farZ);
-			_ndcVertexes[p].position.w = oneOverW;
-			_ndcVertexes[p].color = _shouldPerformPerspectiveCorrection ? clippedPoly[p].color*oneOverW : clippedPoly[p].color;
-			_ndcVertexes[p].texCoords = _shouldPerformPerspectiveCorrection ? clippedPoly[p].texCoords*oneOverW : clippedPoly[p].texCoords;
+		draw.submit();
+	}
+	setDrawState(currentState);
+	_queuedDraws.clear();
+	for (const std::unique_ptr<LayoutStorageBase>& storage : _layoutStorage) {
+		if (storage) {
+			storage->clearQueuedTriangles();
 		}
+	}
+	_queuedTextures.clear();
+}
 
-		if (_shouldPerformCulling && cullFace(_ndcVertexes[0].position, _ndcVertexes[1].position, _ndcVertexes[2].position)) {
-			continue;
+void Renderer::resolveDeferredShading(void) {
+	// the draws are no longer pending while they are shaded, so the shaded pixels are not discarded again
+	vector<DeferredDraw> deferredDraws;
+	deferredDraws.swap(_deferredDraws);
+	// visible pixels are grouped by draw, so each pixel shader runs exactly once per pixel in its own loop
+	_deferredPixels.resize(deferredDraws.size());
+	for (vector<uint32_t>& pixels : _deferredPixels) {
+		pixels.clear();
+	}
+	for (uint32_t pixel = 0; pixel < _visibilityBuffer.size(); ++pixel) {
+		if (_visibilityBuffer[pixel] != 0) {
+			_deferredPixels[_deferredTriangleDraws[_visibilityBuffer[pixel] - 1]].push_back(pixel);
 		}
-		for (int p = 1; p < clippedPoly.size()-1; ++p) {
-			rasterizeTriangle({_ndcVertexes[0], _ndcVertexes[p], _ndcVertexes[p+1]});
+	}
+	// shaders read render state such as the bound texture, so every draw is shaded with the state it was drawn with
+	const DrawState currentState = drawState();
+	const size_t chunkSize = 4096;
+	for (size_t draw = 0; draw < deferredDraws.size(); ++draw) {
+		const vector<uint32_t>& pixels = _deferredPixels[draw];
+		const unsigned int chunkCount = static_cast<unsigned int>((pixels.size() + chunkSize - 1) / chunkSize);
+		setDrawState(deferredDraws[draw].state);
+		auto shadeChunk = [&](unsigned int chunk) {
+			const size_t first = chunk*chunkSize;
+			deferredDraws[draw].shade(pixels.data() + first, std::min(chunkSize, pixels.size() - first));
+		};
+		if (_threadPool && chunkCount > 1) {
+			_threadPool->parallelFor(chunkCount, shadeChunk);
 		}
+		else {
+			for (unsigned int chunk = 0; chunk < chunkCount; ++chunk) {
+				shadeChunk(chunk);
+			}
+		}
+	}
+	setDrawState(currentState);
+	// the emptied vector goes back, so its capacity is reused by the next frame
+	deferredDraws.clear();
+	_deferredDraws.swap(deferredDraws);
+	_deferredTriangleDraws.clear();
+	for (const std::unique_ptr<LayoutStorageBase>& storage : _layoutStorage) {
+		if (storage) {
+			storage->clearDeferredPlanes();
+		}
+	}
+	if (!_shouldDeferShading) {
+		// deferred shading was disabled after these draws
+		vector<uint32_t>().swap(_visibilityBuffer);
 	}
 }
 
-void Renderer::rasterizeTriangle(const Vertex (&verts)[3]) {
-	triangle t = triangleFromVerts(verts);
-	
-	if (t.leftAndRightOnTop) {
-		edgeLoop(verts[t.topIndex], verts[t.midIndex], verts[t.bottomIndex], verts[t.bottomIndex], t.heightOfC);
-		return;
+void Renderer::beginVertexCacheGeneration(void) {
+	if (++_vertexCacheGeneration == 0) {
+		// the stamps wrapped around, so old stamps could match again
+		std::fill(_clipVertexGenerations.begin(), _clipVertexGenerations.end(), 0);
+		_vertexCacheGeneration = 1;
 	}
-	Vertex vOnC = clipVertex(verts[t.topIndex], verts[t.bottomIndex], ((float)t.heightOfA)/t.heightOfC);
-	edgeLoop(verts[t.topIndex], verts[t.topIndex], t.leftSideIsC ? vOnC : verts[t.midIndex], t.leftSideIsC ? verts[t.midIndex] : vOnC, t.heightOfA);
-	edgeLoop(t.leftSideIsC ? vOnC : verts[t.midIndex], t.leftSideIsC ? verts[t.midIndex] : vOnC, verts[t.bottomIndex], verts[t.bottomIndex], t.heightOfB);
 }
 
-void Renderer::edgeLoop(const Vertex& leftStart, const Vertex& rightStart, const Vertex& leftDest, const Vertex&rightDest, int numSteps) {
-	for (int i = 0; i < numSteps; ++i) {
-		float a = ((float)i)/numSteps;
-		drawSpan(clipVertex(leftStart, leftDest, a), clipVertex(rightStart, rightDest, a), leftStart.position.y - i);
+void Renderer::collectDrawVertexes(uint32_t firstIndex, uint32_t indexCount, bool skipRestartIndex) {
+	if (_shortIndexBuffer) {
+		collectDrawVertexes(_shortIndexBuffer->data(), firstIndex, indexCount, skipRestartIndex);
+	}
+	else {
+		collectDrawVertexes(_indexBuffer->data(), firstIndex, indexCount, skipRestartIndex);
 	}
 }
 
-void Renderer::drawSpan(const Vertex& left, const Vertex& right, float y) {
-	Vertex drawLeft(left);
-	Vertex drawRight(right);
-	if (left.position.x > right.position.x) {
-		std::swap(drawLeft, drawRight);
+template <typename Index>
+void Renderer::collectDrawVertexes(const Index* indices, uint32_t firstIndex, uint32_t indexCount, bool skipRestartIndex) {
+	// post-transform cache: every vertex referenced by the draw call is shaded once, however many triangles share it
+	beginVertexCacheGeneration();
+	_drawVertexIndices.clear();
+	for (uint32_t i = firstIndex; i < firstIndex + indexCount; ++i) {
+		uint32_t index = indices[i];
+		if (skipRestartIndex && index == _restartIndex) {
+			continue;
+		}
+		if (_clipVertexGenerations[index] != _vertexCacheGeneration) {
+			_clipVertexGenerations[index] = _vertexCacheGeneration;
+			_drawVertexIndices.push_back(index);
+		}
 	}
-	if (y < 0 || y >= _height) {
+}
+
+void Renderer::collectTriangleIndices(uint32_t firstVertexIndex, uint32_t count) {
+	if (_shortIndexBuffer) {
+		collectTriangleIndices(_shortIndexBuffer->data(), firstVertexIndex, count);
+	}
+	else {
+		collectTriangleIndices(_indexBuffer->data(), firstVertexIndex, count);
+	}
+}
+
+template <typename Index>
+void Renderer::collectTriangleIndices(const Index* indices, uint32_t firstVertexIndex, uint32_t count) {
+	_triangleIndices.clear();
+	auto appendTriangle = [&](uint32_t first, uint32_t second, uint32_t third) {
+		_triangleIndices.insert(_triangleIndices.end(), {first, second, third});
+	};
+	if (_topology == triangleList) {
+		_triangleIndices.assign(indices + firstVertexIndex, indices + firstVertexIndex + count*3);
 		return;
 	}
-	int startX = std::max(floor(drawLeft.position.x), 0.f);
-	int drawY = floor(y);
-	int width = ceil(drawRight.position.x) - startX;
-	for (int i = 0; i < width; ++i) {
-		int drawX = startX+i;
-		float a = ((float)i)/width;
-		if (_pixelShader != nullptr) {
-			Vertex fragment = clipVertex(drawLeft, drawRight, a);
-			if (_shouldPerformDepthTest && !performDepthTest(drawX, drawY, fragment.position.z)) {
-				continue;
+	// strips and fans keep the two indices the next triangle shares, a restart index begins a new primitive
+	uint32_t shared[2] = {0, 0};
+	uint32_t primitiveVertexCount = 0;
+	for (uint32_t i = firstVertexIndex; i < firstVertexIndex + count; ++i) {
+		const uint32_t index = indices[i];
+		if (_shouldRestartPrimitives && index == _restartIndex) {
+			primitiveVertexCount = 0;
+			continue;
+		}
+		if (_topology == triangleStrip) {
+			if (primitiveVertexCount >= 2) {
+				// every other triangle of a strip is swapped to keep the winding of the first one
+				if (primitiveVertexCount % 2 == 0) {
+					appendTriangle(shared[0], shared[1], index);
+				}
+				else {
+					appendTriangle(shared[1], shared[0], index);
+				}
 			}
-			if (_shouldPerformPerspectiveCorrection) {
-				// apply perspective correction (interpolation in screen space is done with texCoords/w and color/w
-				fragment.color /= fragment.position.w;
-				fragment.texCoords /= fragment.position.w;
+			shared[0] = shared[1];
+			shared[1] = index;
+		}
+		else {
+			if (primitiveVertexCount >= 2) {
+				appendTriangle(shared[0], shared[1], index);
 			}
-			vec4 color = _pixelShader(fragment);
-			_buffer.setPixel({static_cast<uint8_t>(color.r*255), static_cast<uint8_t>(color.g*255), static_cast<uint8_t>(color.b*255), static_cast<uint8_t>(color.a*255)}, drawX, drawY);
+			shared[primitiveVertexCount == 0 ? 0 : 1] = index;
 		}
+		++primitiveVertexCount;
+	}
+}
+
+void Renderer::drawTriangles(uint32_t firstVertexIndex, uint32_t count) {
+	if (!_vertexShader) {
+		return;
+	}
+	if (!_pixelShader) {
+		drawTrianglesDepthOnly(firstVertexIndex, count, _vertexShader);
+		return;
+	}
+	drawTriangles(firstVertexIndex, count, _vertexShader, _pixelShader);
+}
+
+void Renderer::drawTrianglesInstanced(uint32_t firstVertexIndex, uint32_t count, uint32_t instanceCount) {
+	if (!_instancedVertexShader) {
+		return;
+	}
+	if (!_pixelShader) {
+		drawTrianglesInstanced(firstVertexIndex, count, instanceCount, _instancedVertexShader, DepthOnlyWriter());
+		return;
+	}
+	drawTrianglesInstanced(firstVertexIndex, count, instanceCount, _instancedVertexShader, _pixelShader);
+}
+
+void Renderer::updateBlockMaxDepth(int blockX, int blockY) {
+	// depth values only ever decrease, so the block is rescanned after writes to tighten the bound
+	const int maxX = std::min(blockX + blockSize, static_cast<int>(_width));
+	const int maxY = std::min(blockY + blockSize, static_cast<int>(_height));
+	float maxDepth = std::numeric_limits<float>::lowest();
+	for (int y = blockY; y < maxY; ++y) {
+		const float* row = &_depthBuffer[y*_width];
+		maxDepth = std::max(maxDepth, *std::max_element(row + blockX, row + maxX));
+	}
+	_blockMaxDepth[(blockY/blockSize)*blocksPerRow() + blockX/blockSize] = maxDepth;
+}
+
+void Renderer::discardDeferredPixel(int x, int y) {
+	// the pixel was drawn right away, so deferred shading must not overwrite it with a triangle behind it
+	const size_t pixel = y*_width + x;
+	if (pixel < _visibilityBuffer.size()) {
+		_visibilityBuffer[pixel] = 0;
 	}
 }
 
@@ -181,31 +395,42 @@ bool Renderer::performDepthTest(int x, int y, float zPosition) {
 	return false;
 }
 
-void Renderer::rasterizeLine(const glm::vec2& start, const glm::vec2 &end, const Pixel& color) {
-	vec2 drawStart(start), drawEnd(end);
-	if (start.y > end.y) {
-		swap(drawStart, drawEnd);
+void Renderer::drawLines(uint32_t firstVertexIndex, uint32_t count) {
+	if (!_vertexShader) {
+		return;
 	}
-	vec2 delta = drawEnd-drawStart;
-	bool interpolateVertically = fabs(delta.x) > fabs(delta.y);
-	
-	if (interpolateVertically) {
-		if (drawStart.x > drawEnd.x) {
-			std::swap(drawStart, drawEnd);
-			delta = drawEnd-drawStart;
+	drawLines(firstVertexIndex, count, _vertexShader);
+}
+
+void Renderer::rasterizeLine(const vec4& start, const vec4& end, const Pixel& color) {
+	// Bresenham between the pixels nearest to the end points, only the depth is stepped in floating point
+	int x = static_cast<int>(floor(start.x + 0.5f));
+	int y = static_cast<int>(floor(start.y + 0.5f));
+	const int endX = static_cast<int>(floor(end.x + 0.5f));
+	const int endY = static_cast<int>(floor(end.y + 0.5f));
+	const int deltaX = abs(endX - x), deltaY = -abs(endY - y);
+	const int stepX = x < endX ? 1 : -1, stepY = y < endY ? 1 : -1;
+	const int steps = std::max(deltaX, -deltaY);
+	float depth = start.z;
+	const float depthStep = steps > 0 ? (end.z - start.z)/steps : 0.f;
+	int error = deltaX + deltaY;
+	for (int i = 0; i <= steps; ++i) {
+		// clipped end points may round to one pixel outside of the viewport
+		if (static_cast<unsigned int>(x) < _width && static_cast<unsigned int>(y) < _height && (!_shouldPerformDepthTest || performDepthTest(x, y, depth))) {
+			_buffer.setPixel(color, x, y);
+			if (!_deferredDraws.empty()) {
+				discardDeferredPixel(x, y);
+			}
 		}
-		int linearValue = floor(drawStart.x);
-		LinearInterpolator lerp(delta.x, delta.y, drawStart.y, fract(drawStart.x));
-		
-		do {
-			_buffer.setPixel(color, linearValue++, floor(lerp.interpolatedValue()));
-		} while(lerp.interpolate());
-	}
-	else {
-		int linearValue = floor(drawStart.y);
-		LinearInterpolator lerp(delta.x, delta.y, drawStart.x, fract(drawStart.y));
-		do {
-			_buffer.setPixel(color, floor(lerp.interpolatedValue()), linearValue++);
-		} while(lerp.interpolate());
+		const int doubledError = 2*error;
+		if (doubledError >= deltaY) {
+			error += deltaY;
+			x += stepX;
+		}
+		if (doubledError <= deltaX) {
+			error += deltaX;
+			y += stepY;
+		}
+		depth += depthStep;
 	}
 }
@@ -3,17 +3,57 @@
 
 #include <cstddef>
 #include <functional>
+#include <initializer_list>
+#include <memory>
+#include <unordered_map>
 #include <glm/glm.hpp>
 #include "Framebuffer.hpp"
 #include "renderlib.hpp"
 #include "Texture.hpp"
 #include "Sampler.hpp"
+#include "ThreadPool.hpp"
 
 using namespace std;
 using namespace glm;
 
 namespace renderlib {
 
+	enum RasterizerType {
+		scanline,
+		halfSpace
+	};
+
+	class CommandList;
+
+	// immutable buffers created once and bound by handle, the renderer keeps a reference instead of a copy.
+	// Vertex buffers of other layouts are bound as std::shared_ptr<const vector<Layout>>.
+	typedef std::shared_ptr<const vector<Vertex>> VertexBufferHandle;
+	typedef std::shared_ptr<const vector<uint32_t>> IndexBufferHandle;
+	typedef std::shared_ptr<const vector<uint16_t>> ShortIndexBufferHandle;
+	typedef std::shared_ptr<const Texture> TextureHandle;
+
+	enum DrawSortOrder {
+		// front to back by the nearest depth of each draw
+		sortByDepth,
+		// grouped by pixel shader, render state and texture, front to back within a group
+		sortByState
+	};
+
+	enum PrimitiveTopology {
+		triangleList,
+		triangleStrip,
+		triangleFan
+	};
+
+	// stands in for the pixel shader while shading is deferred, covered pixels store the id of the triangle
+	struct VisibilityWriter {
+		uint32_t triangleId;
+	};
+
+	// stands in for the pixel shader of depth only draws, nothing but the depth buffer is written
+	struct DepthOnlyWriter {
+	};
+
 	class Renderer {
 	public:
 		Renderer(unsigned int width, unsigned int height);
@@ -21,14 +61,65 @@ namespace renderlib {
 		void setRenderFunc(std::function<void (Renderer&)> handler);
 		void setVertexShader(std::function<Vertex (const Vertex& vertex)> vertexShader);
 		void setPixelShader(std::function<vec4 (const Vertex& fragment)> pixelShader);
+		void setInstancedVertexShader(std::function<Vertex (const Vertex& vertex, uint32_t instance)> vertexShader);
 		void render(void);
+		// replays recorded command lists in the given order, called from the render function
+		void execute(const CommandList& commandList);
+		void execute(const vector<CommandList>& commandLists);
 		const Framebuffer& frameBuffer(void) const;
 		void setViewport(unsigned int x, unsigned int y, unsigned int width, unsigned int height);
 		void setDepthRange(float nearZ, float farZ);
-		void setVertexBuffer(const vector<Vertex>& vertexBuffer);
+		// the vector overloads copy the data, buffers bound by handle are shared with the renderer instead. Vertex
+		// buffers may hold any vertex type, draws whose vertex shader takes another type are skipped.
+		template <typename InputVertex>
+		void setVertexBuffer(const vector<InputVertex>& vertexBuffer) { setVertexBuffer(std::make_shared<const vector<InputVertex>>(vertexBuffer)); }
 		void setIndexBuffer(const vector<uint32_t>& indexBuffer);
+		// braced lists such as setIndexBuffer({0, 1, 2}) are 32 bit indices
+		void setIndexBuffer(std::initializer_list<uint32_t> indexBuffer) { setIndexBuffer(vector<uint32_t>(indexBuffer)); }
+		// 16 bit indices for meshes with less than 65536 vertices, a restart index has to fit into 16 bits as well
+		void setIndexBuffer(const vector<uint16_t>& indexBuffer);
+		template <typename InputVertex>
+		void setVertexBuffer(const std::shared_ptr<const vector<InputVertex>>& vertexBuffer);
+		void setIndexBuffer(const IndexBufferHandle& indexBuffer);
+		void setIndexBuffer(const ShortIndexBufferHandle& indexBuffer);
+		// the bound buffers, a buffer bound by handle is the object the handle points to
+		const std::shared_ptr<const void>& vertexBuffer(void) const { return _vertexBuffer; }
+		const IndexBufferHandle& indexBuffer(void) const { return _indexBuffer; }
+		const ShortIndexBufferHandle& shortIndexBuffer(void) const { return _shortIndexBuffer; }
 		void drawTriangles(uint32_t firstVertexIndex, uint32_t count);
+		// compile time pipeline: the shaders are functors the rasterizer is instantiated for, so their bodies can be
+		// inlined. drawTriangles(firstVertexIndex, count) runs it with the std::function shaders set above.
+		// The vertex shader returns the vertex layout of the draw (see VertexLayout) and the pixel shader is called
+		// with it, so only the floats of that layout are interpolated.
+		template <typename VertexShader, typename PixelShader>
+		void drawTriangles(uint32_t firstVertexIndex, uint32_t count, const VertexShader& vertexShader, const PixelShader& pixelShader);
+		// draws instanceCount copies of the triangles, the vertex shader is called as vertexShader(vertex, instance)
+		// and can read per instance data such as a model matrix from a buffer it references. All copies are
+		// submitted as one draw, without a pixel shader they only write depth.
+		void drawTrianglesInstanced(uint32_t firstVertexIndex, uint32_t count, uint32_t instanceCount);
+		template <typename VertexShader, typename PixelShader>
+		void drawTrianglesInstanced(uint32_t firstVertexIndex, uint32_t count, uint32_t instanceCount, const VertexShader& vertexShader, const PixelShader& pixelShader);
+		// depth pre-passes and shadow maps: only depth is interpolated and written, the color buffer is left alone.
+		// With depth testing disabled the depth is written without being tested.
+		// drawTriangles(firstVertexIndex, count) and drawTrianglesInstanced take this path when no pixel shader is set.
+		template <typename VertexShader>
+		void drawTrianglesDepthOnly(uint32_t firstVertexIndex, uint32_t count, const VertexShader& vertexShader) { drawTriangles(firstVertexIndex, count, vertexShader, DepthOnlyWriter()); }
+		// lines between pairs of indices, drawn in the color the vertex shader gives the first vertex of each
+		// pair, so its layout needs a color. Depth is tested and written when depth testing is enabled.
+		void drawLines(uint32_t firstVertexIndex, uint32_t count);
+		template <typename VertexShader>
+		void drawLines(uint32_t firstVertexIndex, uint32_t count, const VertexShader& vertexShader);
+		// for strips and fans drawTriangles reads count indices instead of count triangles. With primitive restart
+		// enabled the restart index ends the current strip or fan and the following indices begin a new one,
+		// triangle lists and lines read every index as a vertex.
+		void setPrimitiveTopology(PrimitiveTopology topology) { _topology = topology; }
+		PrimitiveTopology primitiveTopology(void) const { return _topology; }
+		void enablePrimitiveRestart(uint32_t restartIndex) { _shouldRestartPrimitives = true; _restartIndex = restartIndex; }
+		void disablePrimitiveRestart(void) { _shouldRestartPrimitives = false; }
+		// the Texture overload copies the texture, a handle is shared with the renderer
 		void setTexture(const Texture& t);
+		void setTexture(const TextureHandle& texture);
+		const TextureHandle& texture(void) const { return _texture; }
 		void enablePerspectiveCorrection(void);
 		void disablePerspectiveCorrection(void);
 		void enableDepthTesting(void) { _shouldPerformDepthTest = true; }
@@ -36,16 +127,165 @@ namespace renderlib {
 		float aspectRatio(void) const { return ((float)_width)/_height; }
 		void enableCulling(void) { _shouldPerformCulling = true; }
 		void disableCulling(void) { _shouldPerformCulling = false; }
+		void setRasterizer(RasterizerType rasterizer) { _rasterizer = rasterizer; }
+		RasterizerType rasterizer(void) const { return _rasterizer; }
+		// with more than one thread triangles are binned into tiles and rasterized in parallel, shaders have to be thread safe
+		void setThreadCount(unsigned int threadCount);
+		unsigned int threadCount(void) const { return _threadPool ? _threadPool->threadCount() : 1; }
+		// triangles within guardBand times the viewport extent are only clipped against near and far. Edge
+		// functions are evaluated in 32 bits, so the guard band is kept between 1 and maxGuardBand()
+		void setGuardBand(float guardBand);
+		float guardBand(void) const { return std::min(_guardBand, maxGuardBand()); }
+		float maxGuardBand(void) const;
+		// deferred shading: draws only rasterize depth and a triangle id per pixel, render() runs the pixel shaders
+		// once per visible pixel after the render function returned, so shaders must not reference its locals
+		void enableDeferredShading(void) { _shouldDeferShading = true; }
+		// releases the visibility buffer, right away or after the draws deferred so far in the frame are shaded
+		void disableDeferredShading(void);
+		// depth tested draws are queued and submitted front to back when the frame ends, so the depth test rejects
+		// as many fragments as possible. Their shaders run after the render function returned. Where draws have
+		// exactly the same depth the result may differ from submission order.
+		void enableDrawSorting(void) { _shouldSortDraws = true; }
+		void disableDrawSorting(void);
+		void setDrawSortOrder(DrawSortOrder order) { _drawSortOrder = order; }
+		DrawSortOrder drawSortOrder(void) const { return _drawSortOrder; }
+		static const int tileSize = 64;
+		// the half-space rasterizer classifies blocks of this size before testing single pixels
+		static const int blockSize = 8;
 
 	private:
+		template <typename Varyings>
+		struct AssembledTriangle {
+			Varyings verts[3];
+		};
+		// per vertex and per triangle buffers of one vertex layout, created the first time a draw uses the layout
+		struct LayoutStorageBase {
+			virtual ~LayoutStorageBase() {}
+			virtual void clearQueuedTriangles(void) = 0;
+			virtual void clearDeferredPlanes(void) = 0;
+		};
+		template <typename Varyings>
+		struct LayoutStorage : LayoutStorageBase {
+			vector<Varyings> clipVertexes;
+			vector<Varyings> windowVertexes;
+			vector<AssembledTriangle<Varyings>> assembledTriangles;
+			vector<AssembledTriangle<Varyings>> queuedTriangles;
+			vector<AttributePlanes<Varyings>> deferredPlanes;
+			void clearQueuedTriangles(void) { queuedTriangles.clear(); }
+			void clearDeferredPlanes(void) { deferredPlanes.clear(); }
+		};
+		// render state a queued draw is submitted and a deferred draw is shaded with
+		struct DrawState {
+			bool depthTest;
+			bool perspectiveCorrection;
+			bool deferShading;
+			RasterizerType rasterizer;
+			TextureHandle texture;
+		};
+		struct QueuedDraw {
+			float nearestDepth;
+			// pixel shader and render state in the upper, texture in the lower 32 bits
+			uint64_t stateKey;
+			DrawState state;
+			std::function<void (void)> submit;
+		};
+		struct DeferredDraw {
+			DrawState state;
+			std::function<void (const uint32_t* pixels, size_t count)> shade;
+		};
+		// render state the fragment path is compiled for
+		template <bool depthTest, bool perspectiveCorrection>
+		struct FragmentState {
+			static const bool shouldPerformDepthTest = depthTest;
+			static const bool shouldPerformPerspectiveCorrection = perspectiveCorrection;
+		};
+		template <typename Varyings, typename PixelShader>
+		using TriangleRasterizer = void (Renderer::*)(const Varyings (&verts)[3], const PixelRect& clipRect, const PixelShader& pixelShader);
 		bool performDepthTest(int x, int y, float zPosition);
-		vector<Vertex> transformAndClipTriangle(int startIndex);
-		void rasterizeLine(const glm::vec2& start, const glm::vec2 &end, const Pixel& color);
-		void rasterizeTriangle(const Vertex (&verts)[3]);
-		void edgeLoop(const Vertex& leftStart, const Vertex& rightStart, const Vertex& leftDest, const Vertex&rightDest, int numSteps);
-		std::tuple<unsigned int, unsigned int, unsigned int, unsigned int> categorizedIndices(const Vertex (&verts)[3]) const;
-		void drawSpan(int leftX, int rightX, int y, const Pixel& color);
-		void drawSpan(const Vertex& left, const Vertex& right, float y);
+		float blockMaxDepth(int x, int y) const { return _blockMaxDepth[(y/blockSize)*blocksPerRow() + x/blockSize]; }
+		void updateBlockMaxDepth(int blockX, int blockY);
+		int blocksPerRow(void) const { return (static_cast<int>(_width) + blockSize - 1)/blockSize; }
+		static uint32_t nextLayoutId(void);
+		// every type used as a vertex or a vertex layout gets an id the first time it is bound or drawn
+		template <typename Layout>
+		static uint32_t layoutId(void) { static const uint32_t id = nextLayoutId(); return id; }
+		// a draw is skipped when its vertex shader does not take the vertex type of the bound buffer
+		template <typename InputVertex>
+		bool isVertexBufferOf(void) const { return _vertexData && _vertexBufferLayout == layoutId<InputVertex>(); }
+		template <typename Varyings>
+		LayoutStorage<Varyings>& layoutStorage(void);
+		void beginVertexCacheGeneration(void);
+		bool restartsTriangles(void) const { return _shouldRestartPrimitives && _topology != triangleList; }
+		void collectDrawVertexes(uint32_t firstIndex, uint32_t indexCount, bool skipRestartIndex);
+		template <typename Index>
+		void collectDrawVertexes(const Index* indices, uint32_t firstIndex, uint32_t indexCount, bool skipRestartIndex);
+		template <typename VertexShader>
+		void processVertexes(uint32_t firstIndex, uint32_t indexCount, bool skipRestartIndex, const VertexShader& vertexShader);
+		template <typename VertexShader>
+		void shadeDrawVertexes(const VertexShader& vertexShader);
+		template <typename Varyings>
+		void transformToWindow(LayoutStorage<Varyings>& storage, const uint32_t* indices, unsigned int count);
+		template <typename Varyings>
+		Varyings windowVertex(const Varyings& clipVertex) const;
+		template <typename Varyings>
+		int assembleTriangle(const LayoutStorage<Varyings>& storage, uint32_t first, uint32_t second, uint32_t third, Varyings (&windowVertexes)[maxClippedVertexCount]);
+		template <typename Varyings>
+		void rasterizeLines(uint32_t firstVertexIndex, uint32_t count);
+		template <typename Varyings, typename Index>
+		void rasterizeLines(const Index* indices, uint32_t firstVertexIndex, uint32_t count);
+		void rasterizeLine(const vec4& start, const vec4& end, const Pixel& color);
+		void collectTriangleIndices(uint32_t firstVertexIndex, uint32_t count);
+		template <typename Index>
+		void collectTriangleIndices(const Index* indices, uint32_t firstVertexIndex, uint32_t count);
+		template <typename Varyings>
+		void assembleTriangles(void);
+		template <typename Varyings>
+		int binTriangles(void);
+		template <typename Varyings, typename PixelShader>
+		void submitDraw(const PixelShader& pixelShader);
+		template <typename Varyings, typename PixelShader>
+		void submitTriangles(const PixelShader& pixelShader);
+		template <typename Varyings, typename PixelShader>
+		void queueDraw(const PixelShader& pixelShader);
+		void flushQueuedDraws(void);
+		DrawState drawState(void) const;
+		void setDrawState(const DrawState& state);
+		template <typename Varyings, typename PixelShader>
+		uint64_t drawStateKey(void);
+		static uint32_t nextPipelineId(void);
+		template <typename Varyings, typename PixelShader, typename ShaderForTriangle>
+		void rasterizeTriangles(TriangleRasterizer<Varyings, PixelShader> rasterizeTriangle, const ShaderForTriangle& shaderForTriangle);
+		template <typename Varyings, typename PixelShader>
+		void deferPixelShader(const PixelShader& pixelShader);
+		template <typename State, typename Varyings, typename PixelShader>
+		void shadeDeferredPixels(const uint32_t* pixels, size_t count, const AttributePlanes<Varyings>* planes, uint32_t firstTriangleId, const PixelShader& pixelShader);
+		void resolveDeferredShading(void);
+		template <typename Varyings, typename PixelShader>
+		TriangleRasterizer<Varyings, PixelShader> selectTriangleRasterizer(void) const;
+		template <typename State, typename Varyings, typename PixelShader>
+		void rasterizeTriangleScanline(const Varyings (&verts)[3], const PixelRect& clipRect, const PixelShader& pixelShader);
+		template <typename State, typename Varyings, typename PixelShader>
+		void rasterizeTriangleHalfSpace(const Varyings (&verts)[3], const PixelRect& clipRect, const PixelShader& pixelShader);
+		template <typename State, typename Varyings, typename PixelShader>
+		void edgeLoop(const Varyings& leftStart, const Varyings& rightStart, const Varyings& leftDest, const Varyings&rightDest, int numSteps, const AttributePlanes<Varyings>& planes, const PixelRect& clipRect, const PixelShader& pixelShader);
+		template <typename State, typename Varyings, typename PixelShader>
+		void drawSpan(float leftX, float rightX, float y, const AttributePlanes<Varyings>& planes, const PixelRect& clipRect, const PixelShader& pixelShader);
+		template <typename State, typename Varyings, typename PixelShader>
+		bool shadeFragment(int x, int y, const Varyings& fragment, const PixelShader& pixelShader);
+		template <typename State, typename Varyings, typename PixelShader>
+		void writeFragment(int x, int y, const Varyings& fragment, const PixelShader& pixelShader);
+		template <typename State, typename Varyings>
+		void writeFragment(int x, int y, const Varyings&, const VisibilityWriter& writer) { _visibilityBuffer[y*_width + x] = writer.triangleId; }
+		void discardDeferredPixel(int x, int y);
+		// without depth testing a depth only draw writes its depth here, the block maximum is raised to cover it
+		template <typename State, typename Varyings>
+		void writeFragment(int x, int y, const Varyings& fragment, const DepthOnlyWriter&) {
+			if (!State::shouldPerformDepthTest) {
+				_depthBuffer[y*_width + x] = fragment.position.z;
+				float& maxDepth = _blockMaxDepth[(y/blockSize)*blocksPerRow() + x/blockSize];
+				maxDepth = std::max(maxDepth, fragment.position.z);
+			}
+		}
 		unsigned int _x, _y, _width, _height;
 		float _nearZ, _farZ;
 		Pixel _clearColor;
@@ -53,16 +293,51 @@ namespace renderlib {
 		std::function<void (Renderer&)> _renderFunction;
 		std::function<Vertex (const Vertex& vertex)> _vertexShader;
 		std::function<vec4 (const Vertex& fragment)> _pixelShader;
-		vector<Vertex> _vertexBuffer;
-		vector<uint32_t> _indexBuffer;
-		vector<Vertex> _clipVertexes;
-		vector<Vertex> _ndcVertexes;
+		std::function<Vertex (const Vertex& vertex, uint32_t instance)> _instancedVertexShader;
+		// the bound vertex buffer of any vertex type, the vertex shader casts its data back to the type it takes
+		std::shared_ptr<const void> _vertexBuffer;
+		const void* _vertexData;
+		size_t _vertexCount;
+		uint32_t _vertexBufferLayout;
+		IndexBufferHandle _indexBuffer;
+		ShortIndexBufferHandle _shortIndexBuffer;
+		// storage of every vertex layout drawn so far, indexed by layout id
+		vector<std::unique_ptr<LayoutStorageBase>> _layoutStorage;
+		vector<unsigned int> _clipOutcodes;
+		vector<uint32_t> _clipVertexGenerations;
+		vector<uint32_t> _drawVertexIndices;
+		// three vertex indices per triangle of the current draw, strips and fans are already taken apart
+		vector<uint32_t> _triangleIndices;
+		uint32_t _vertexCacheGeneration;
 		vector<float> _depthBuffer;
-		Texture _texture;
+		// hierarchical z: an upper bound of the stored depth in every block of blockSize x blockSize pixels
+		vector<float> _blockMaxDepth;
+		TextureHandle _texture;
 		bool _shouldPerformPerspectiveCorrection;
 		bool _shouldPerformDepthTest;
 		bool _shouldPerformCulling;
+		RasterizerType _rasterizer;
+		PrimitiveTopology _topology;
+		bool _shouldRestartPrimitives;
+		uint32_t _restartIndex;
+		float _guardBand;
+		std::unique_ptr<ThreadPool> _threadPool;
+		vector<vector<uint32_t>> _tileBins;
+		bool _shouldSortDraws;
+		DrawSortOrder _drawSortOrder;
+		vector<QueuedDraw> _queuedDraws;
+		// ids of the textures of the queued draws in the order they were first queued, the texture part of the state keys
+		std::unordered_map<const Texture*, uint32_t> _queuedTextures;
+		bool _shouldDeferShading;
+		// triangle id per pixel, ids start at 1 and index _deferredTriangleDraws, 0 marks pixels without a triangle
+		vector<uint32_t> _visibilityBuffer;
+		// the deferred draw every triangle id belongs to, the attribute planes are kept with the vertex layout
+		vector<uint32_t> _deferredTriangleDraws;
+		vector<DeferredDraw> _deferredDraws;
+		vector<vector<uint32_t>> _deferredPixels;
 	};
 }
 
+#include "Pipeline.hpp"
+
 #endif /* Renderer_hpp */
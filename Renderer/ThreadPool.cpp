@@ -0,0 +1,69 @@
+#include "ThreadPool.hpp"
+
+using namespace renderlib;
+using namespace std;
+
+ThreadPool::ThreadPool(unsigned int threadCount) : _task(nullptr), _taskCount(0), _nextTask(0), _busyWorkers(0), _generation(0), _shouldTerminate(false) {
+	for (unsigned int i = 1; i < threadCount; ++i) {
+		_workers.emplace_back(&ThreadPool::workerLoop, this);
+	}
+}
+
+ThreadPool::~ThreadPool() {
+	{
+		lock_guard<mutex> lock(_mutex);
+		_shouldTerminate = true;
+	}
+	_wakeCondition.notify_all();
+	for (thread& worker : _workers) {
+		worker.join();
+	}
+}
+
+void ThreadPool::parallelFor(unsigned int count, const function<void (unsigned int)>& task) {
+	if (_workers.empty() || count < 2) {
+		for (unsigned int i = 0; i < count; ++i) {
+			task(i);
+		}
+		return;
+	}
+	{
+		lock_guard<mutex> lock(_mutex);
+		_task = &task;
+		_taskCount = count;
+		_nextTask = 0;
+		_busyWorkers = static_cast<unsigned int>(_workers.size());
+		++_generation;
+	}
+	_wakeCondition.notify_all();
+	runTasks();
+
+	unique_lock<mutex> lock(_mutex);
+	_doneCondition.wait(lock, [this] { return _busyWorkers == 0; });
+	_task = nullptr;
+}
+
+void ThreadPool::runTasks(void) {
+	for (unsigned int i = _nextTask++; i < _taskCount; i = _nextTask++) {
+		(*_task)(i);
+	}
+}
+
+void ThreadPool::workerLoop(void) {
+	uint64_t finishedGeneration = 0;
+	while (true) {
+		{
+			unique_lock<mutex> lock(_mutex);
+			_wakeCondition.wait(lock, [&] { return _shouldTerminate || _generation != finishedGeneration; });
+			if (_shouldTerminate) {
+				return;
+			}
+			finishedGeneration = _generation;
+		}
+		runTasks();
+		lock_guard<mutex> lock(_mutex);
+		if (--_busyWorkers == 0) {
+			_doneCondition.notify_one();
+		}
+	}
+}
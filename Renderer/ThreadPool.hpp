@@ -0,0 +1,40 @@
+#ifndef ThreadPool_hpp
+#define ThreadPool_hpp
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace renderlib {
+
+	// Persistent worker threads that execute indexed jobs; the calling thread takes part in the work
+	class ThreadPool {
+	public:
+		ThreadPool(unsigned int threadCount);
+		~ThreadPool();
+		ThreadPool(const ThreadPool&) = delete;
+		ThreadPool& operator=(const ThreadPool&) = delete;
+		unsigned int threadCount(void) const { return static_cast<unsigned int>(_workers.size())+1; }
+		// runs task(i) for every i in [0, count) and returns after all of them have finished
+		void parallelFor(unsigned int count, const std::function<void (unsigned int)>& task);
+	private:
+		void workerLoop(void);
+		void runTasks(void);
+		std::vector<std::thread> _workers;
+		std::mutex _mutex;
+		std::condition_variable _wakeCondition;
+		std::condition_variable _doneCondition;
+		const std::function<void (unsigned int)>* _task;
+		unsigned int _taskCount;
+		std::atomic<unsigned int> _nextTask;
+		unsigned int _busyWorkers;
+		uint64_t _generation;
+		bool _shouldTerminate;
+	};
+}
+
+#endif /* ThreadPool_hpp */
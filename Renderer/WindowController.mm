@@ -2,6 +2,7 @@
 #include "Framebuffer.hpp"
 #include "Renderer.hpp"
 #include <glm/glm.hpp>
+#include <thread>
 #include "demo.hpp"
 
 using namespace renderlib;
@@ -93,6 +94,28 @@ typedef CGImageRef (^RenderBlock)(const renderlib::Framebuffer& framebuffer);
 	}
 }
 
+- (IBAction)toggleHalfSpaceRasterizer:(id)sender {
+	if ([sender state] == NSOnState) {
+		_renderer->setRasterizer(scanline);
+		[sender setState:NSOffState];
+	}
+	else {
+		_renderer->setRasterizer(halfSpace);
+		[sender setState:NSOnState];
+	}
+}
+
+- (IBAction)toggleMultithreading:(id)sender {
+	if ([sender state] == NSOnState) {
+		_renderer->setThreadCount(1);
+		[sender setState:NSOffState];
+	}
+	else {
+		_renderer->setThreadCount(std::thread::hardware_concurrency());
+		[sender setState:NSOnState];
+	}
+}
+
 - (IBAction)switchRenderMode:(id)sender {
 	std::vector<std::function<void (Renderer&)>> renderFunctions = {
 		renderSceneBasic,
@@ -54,7 +54,7 @@ vector<Vertex> vertexes = {
 	{{-1.0f,  1.0f,  1.0f, 1.f}, {1.f, 0.f, 0.f, 1.f}, {1.f, 1.f}},
 	{{-1.0f,  1.0f, -1.0f, 1.f}, {1.f, 0.f, 1.f, 1.f}, {0.f, 1.f}}
 };
-vector<unsigned int> indices = {
+vector<uint16_t> indices = {
 	0,  1,  2,      0,  2,  3,    // front
 	4,  5,  6,      4,  6,  7,    // back
 	8,  9,  10,     8,  10, 11,   // top
@@ -63,17 +63,71 @@ vector<unsigned int> indices = {
 	20, 21, 22,     20, 22, 23    // left
 };
 
-vec4 basicPixelShader(const Vertex& fragment) {
-	return {1.f,0.f,1.f,1.f};
-}
+// created once, binding them every frame shares the data with the renderer
+const VertexBufferHandle vertexBuffer = std::make_shared<const vector<Vertex>>(vertexes);
+const ShortIndexBufferHandle indexBuffer = std::make_shared<const vector<uint16_t>>(indices);
 
-vec4 desaturationPixelShader(const Vertex& fragment) {
-	return {glm::saturation(.0f, vec3(fragment.color)), 1};
-}
+// vertex layouts with only what the pixel shaders of a scene read, so nothing else is interpolated
+struct ClipPosition {
+	vec4 position;
+};
 
-vec4 colorPixelShader(const Vertex& fragment) {
-	return fragment.color;
-}
+struct ColoredVertex {
+	vec4 position;
+	vec4 color;
+};
+
+struct TexturedVertex {
+	vec4 position;
+	vec2 texCoords;
+};
+
+// shaders are functors, so the renderer's compile time pipeline can inline them
+struct BasicPixelShader {
+	vec4 operator()(const ClipPosition& fragment) const {
+		return {1.f,0.f,1.f,1.f};
+	}
+};
+
+struct DesaturationPixelShader {
+	vec4 operator()(const ColoredVertex& fragment) const {
+		return {glm::saturation(.0f, vec3(fragment.color)), 1};
+	}
+};
+
+struct ColorPixelShader {
+	vec4 operator()(const ColoredVertex& fragment) const {
+		return fragment.color;
+	}
+};
+
+struct TransformVertexShader {
+	mat4 mvp;
+	Vertex operator()(const Vertex& vertex) const {
+		return {mvp * vertex.position, vertex.color, vertex.texCoords};
+	}
+};
+
+struct PositionVertexShader {
+	mat4 mvp;
+	ClipPosition operator()(const Vertex& vertex) const {
+		return {mvp * vertex.position};
+	}
+};
+
+struct ColorVertexShader {
+	mat4 mvp;
+	ColoredVertex operator()(const Vertex& vertex) const {
+		return {mvp * vertex.position, vertex.color};
+	}
+};
+
+struct TexCoordsVertexShader {
+	mat4 mvp;
+	TexturedVertex operator()(const Vertex& vertex) const {
+		return {mvp * vertex.position, vertex.texCoords};
+	}
+};
 
 
 mat4 modelView() {
@@ -89,51 +143,41 @@ mat4 modelView() {
 	return modelView;
 }
 
-void setupCommonRendering(renderlib::Renderer& renderer) {
-	renderer.setVertexBuffer(vertexes);
-	renderer.setIndexBuffer(indices);
+mat4 setupCommonRendering(renderlib::Renderer& renderer) {
+	renderer.setVertexBuffer(vertexBuffer);
+	renderer.setIndexBuffer(indexBuffer);
 
 	mat4 projection = glm::perspective(glm::radians(60.0f), renderer.aspectRatio(), 0.1f, 1000.f);
-	mat4 mvp = projection*modelView();
-	
-	renderer.setVertexShader([=](const Vertex& vertex)-> Vertex {
-		return {mvp * vertex.position, vertex.color, vertex.texCoords};
-	});
+	return projection*modelView();
 }
 
 void renderSceneBasic(renderlib::Renderer& renderer) {
-	setupCommonRendering(renderer);
-	
-	renderer.setPixelShader(basicPixelShader);
+	PositionVertexShader vertexShader = {setupCommonRendering(renderer)};
 	
-	renderer.drawTriangles(0, 12);
+	renderer.drawTriangles(0, 12, vertexShader, BasicPixelShader());
 }
 
 void renderSceneGouraud(renderlib::Renderer& renderer) {
-	setupCommonRendering(renderer);
+	ColorVertexShader vertexShader = {setupCommonRendering(renderer)};
 	
-	renderer.setPixelShader(colorPixelShader);
-	
-	renderer.drawTriangles(0, 12);
+	renderer.drawTriangles(0, 12, vertexShader, ColorPixelShader());
 }
 
 void renderSceneTextured(renderlib::Renderer& renderer) {
-	setupCommonRendering(renderer);
+	TexCoordsVertexShader vertexShader = {setupCommonRendering(renderer)};
 	Sampler sampler = Sampler(checkerBoard);
-	renderer.setPixelShader([&](const Vertex& fragment) {
+	
+	renderer.drawTriangles(0, 12, vertexShader, [sampler](const TexturedVertex& fragment) {
 		return sampler.lookup(fragment.texCoords);
 	});
-	
-	renderer.drawTriangles(0, 12);
 }
 
 void renderSceneTexturedAndColor(renderlib::Renderer& renderer) {
-	setupCommonRendering(renderer);
+	TransformVertexShader vertexShader = {setupCommonRendering(renderer)};
 
 	Sampler sampler = Sampler(tex);
-	renderer.setPixelShader([&](const Vertex& fragment) {
+	
+	renderer.drawTriangles(0, 12, vertexShader, [sampler](const Vertex& fragment) {
 		return sampler.lookup(fragment.texCoords) * fragment.color;
 	});
-	
-	renderer.drawTriangles(0, 12);
 }
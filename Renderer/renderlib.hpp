@@ -1,7 +1,9 @@
 #ifndef renderlib_h
 #define renderlib_h
 
+#include <algorithm>
 #include <cstdint>
+#include <cmath>
 #include <tuple>
 #include <limits>
 #include <glm/glm.hpp>
@@ -17,6 +19,49 @@ namespace renderlib {
 		glm::vec2 texCoords;
 	};
 	
+	// A vertex layout is a struct of floats that begins with the clip space position, for example
+	//   struct LitVertex { glm::vec4 position; glm::vec3 normal; glm::vec2 texCoords; };
+	// Vertex shaders return one and pixel shaders read it, the pipeline stores, clips and interpolates exactly its
+	// floats. Vertex is the layout of the std::function shaders.
+	template <typename Varyings>
+	struct VertexLayout {
+		static_assert(sizeof(Varyings) % sizeof(float) == 0 && sizeof(Varyings) >= sizeof(glm::vec4), "a vertex layout is a position followed by floats");
+		static const int floatCount = sizeof(Varyings)/sizeof(float);
+		static float* floats(Varyings& v) { return reinterpret_cast<float*>(&v); }
+		static const float* floats(const Varyings& v) { return reinterpret_cast<const float*>(&v); }
+	};
+	
+	// calls function(i) for every i in [first, last), unrolled at compile time. Per pixel loops over the floats of a
+	// layout use it, so the compiler can keep a fragment in registers and drop the floats its pixel shader never reads.
+	template <int first, int last>
+	struct UnrolledLoop {
+		template <typename Function>
+		static void run(const Function& function) {
+			function(first);
+			UnrolledLoop<first + 1, last>::run(function);
+		}
+	};
+	
+	template <int last>
+	struct UnrolledLoop<last, last> {
+		template <typename Function>
+		static void run(const Function&) {}
+	};
+	
+	// multiplies the floats after the position, perspective correct interpolation works on the varyings divided by w
+	template <typename Varyings>
+	inline void scaleVaryings(Varyings& v, float scale) {
+		float* value = VertexLayout<Varyings>::floats(v);
+		for (int i = 4; i < VertexLayout<Varyings>::floatCount; ++i) {
+			value[i] *= scale;
+		}
+	}
+	
+	// inclusive pixel bounds a triangle is rasterized into
+	struct PixelRect {
+		int minX, minY, maxX, maxY;
+	};
+	
 	struct triangle {
 		unsigned int leftIndex;
 		unsigned int rightIndex;
@@ -42,7 +87,8 @@ namespace renderlib {
 		return theIndex > 0 ? theIndex-1 : 2;
 	}
 	
-	inline std::tuple<unsigned int, unsigned int, unsigned int, unsigned int> categorizedIndices(const Vertex (&verts)[3]) {
+	template <typename Varyings>
+	inline std::tuple<unsigned int, unsigned int, unsigned int, unsigned int> categorizedIndices(const Varyings (&verts)[3]) {
 		unsigned int top{0}, bottom{0}, left{0}, right{0};
 		float minX = std::numeric_limits<float>::max();
 		float maxX = std::numeric_limits<float>::lowest();
@@ -70,7 +116,8 @@ namespace renderlib {
 		return std::make_tuple(left, top, right, bottom);
 	}
 	
-	inline triangle triangleFromVerts(const Vertex (&verts)[3]) {
+	template <typename Varyings>
+	inline triangle triangleFromVerts(const Varyings (&verts)[3]) {
 		triangle t;
 
 		std::tie(t.leftIndex, t.topIndex, t.rightIndex, t.bottomIndex) = categorizedIndices(verts);
@@ -153,15 +200,34 @@ namespace renderlib {
 		}
 	}
 	
+	// one bit per clip plane the vertex lies outside of
+	inline unsigned int clipOutcode(const glm::vec4& v) {
+		unsigned int outcode = 0;
+		for (ClipPlane plane : {left, right, top, bottom, near, far}) {
+			if (!isVertexInsidePlane(v, plane)) {
+				outcode |= 1 << plane;
+			}
+		}
+		return outcode;
+	}
+	
 	inline float interpolationFactor(float a, float b) {
 		return a / (a-b);
 	}
 	
-	inline Vertex clipVertex(const Vertex& start, const Vertex& end, float a) {
-		return {start.position*(1.f-a) + end.position*a, start.color*(1.f-a) + end.color*a, start.texCoords*(1.f-a) + end.texCoords*a};
+	template <typename Varyings>
+	inline Varyings clipVertex(const Varyings& start, const Varyings& end, float a) {
+		typedef VertexLayout<Varyings> Layout;
+		Varyings v;
+		float* value = Layout::floats(v);
+		for (int i = 0; i < Layout::floatCount; ++i) {
+			value[i] = Layout::floats(start)[i]*(1.f-a) + Layout::floats(end)[i]*a;
+		}
+		return v;
 	}
 	
-	inline Vertex intersectVertex(const Vertex& v0, const Vertex& v1, ClipPlane plane) {
+	template <typename Varyings>
+	inline Varyings intersectVertex(const Varyings& v0, const Varyings& v1, ClipPlane plane) {
 		float a;
 		const glm::vec4 & p0 = v0.position;
 		const glm::vec4 & p1 = v1.position;
@@ -188,33 +254,113 @@ namespace renderlib {
 		return clipVertex(v0, v1, a);
 	}
 	
-	inline std::vector<Vertex> clipPolygonToPlane(const std::vector<Vertex>& verts, ClipPlane plane) {
-		std::vector<Vertex> clippedPolygon;
-		
-		for (int i = 0; i < verts.size(); ++i) {
-			int nextIndex = i == verts.size()-1 ? 0 : i+1;
-			const Vertex& v0 = verts[i];
-			const Vertex& v1 = verts[nextIndex];
+	// moves the end points of a line in clip space onto the planes it crosses, false if no part of it is visible
+	template <typename Varyings>
+	inline bool clipLineToFrustum(Varyings& start, Varyings& end) {
+		for (ClipPlane plane : {left, right, top, bottom, near, far}) {
+			bool startVisible = isVertexInsidePlane(start.position, plane);
+			bool endVisible = isVertexInsidePlane(end.position, plane);
+			if (!startVisible && !endVisible) {
+				return false;
+			}
+			if (!startVisible) {
+				start = intersectVertex(start, end, plane);
+			}
+			else if (!endVisible) {
+				end = intersectVertex(start, end, plane);
+			}
+		}
+		return true;
+	}
+	
+	// every clip plane adds at most one vertex, so a clipped triangle has no more than nine
+	static const int maxClippedVertexCount = 9;
+	
+	template <typename Varyings>
+	struct ClippedPolygon {
+		Varyings verts[maxClippedVertexCount];
+		int count;
+	};
+	
+	template <typename Varyings>
+	inline void clipPolygonToPlane(const ClippedPolygon<Varyings>& polygon, ClippedPolygon<Varyings>& clippedPolygon, ClipPlane plane) {
+		clippedPolygon.count = 0;
+		for (int i = 0; i < polygon.count; ++i) {
+			int nextIndex = i == polygon.count-1 ? 0 : i+1;
+			const Varyings& v0 = polygon.verts[i];
+			const Varyings& v1 = polygon.verts[nextIndex];
 			bool p0Visible = isVertexInsidePlane(v0.position, plane);
 			bool p1Visible = isVertexInsidePlane(v1.position, plane);
 			
 			if (p0Visible != p1Visible) {
-				clippedPolygon.push_back(intersectVertex(v0, v1, plane));
+				clippedPolygon.verts[clippedPolygon.count++] = intersectVertex(v0, v1, plane);
 			}
 			if (p1Visible) {
-				clippedPolygon.push_back(v1);
+				clippedPolygon.verts[clippedPolygon.count++] = v1;
+			}
+		}
+	}
+	
+	template <typename Varyings>
+	inline bool isPolygonInsidePlane(const ClippedPolygon<Varyings>& polygon, ClipPlane plane) {
+		for (int i = 0; i < polygon.count; ++i) {
+			if (!isVertexInsidePlane(polygon.verts[i].position, plane)) {
+				return false;
+			}
+		}
+		return true;
+	}
+	
+	// clips against the given planes, ping-ponging between the result and a scratch polygon on the stack.
+	// Planes that no vertex crosses are skipped.
+	template <typename Varyings, size_t planeCount>
+	inline void clipPolygonToPlanes(ClippedPolygon<Varyings>& polygon, const ClipPlane (&planes)[planeCount]) {
+		ClippedPolygon<Varyings> scratch;
+		ClippedPolygon<Varyings>* source = &polygon;
+		ClippedPolygon<Varyings>* destination = &scratch;
+		for (ClipPlane plane : planes) {
+			if (source->count < 3) {
+				break;
+			}
+			if (isPolygonInsidePlane(*source, plane)) {
+				continue;
 			}
+			clipPolygonToPlane(*source, *destination, plane);
+			std::swap(source, destination);
 		}
-		return clippedPolygon;
+		if (source != &polygon) {
+			polygon.count = source->count;
+			std::copy(source->verts, source->verts + source->count, polygon.verts);
+		}
+	}
+	
+	template <typename Varyings>
+	inline void clipTriangleToFrustum(const Varyings (&verts)[3], ClippedPolygon<Varyings>& clippedPolygon) {
+		static const ClipPlane planes[] = {left, right, top, bottom, near, far};
+		std::copy(verts, verts + 3, clippedPolygon.verts);
+		clippedPolygon.count = 3;
+		clipPolygonToPlanes(clippedPolygon, planes);
+	}
+	
+	// the guard band is a multiple of the viewport extent in clip space, triangles inside of it are rasterized
+	// without clipping against the x and y planes
+	inline bool isVertexInsideGuardBand(const glm::vec4& v, float guardBand) {
+		return fabs(v.x) <= guardBand*v.w && fabs(v.y) <= guardBand*v.w;
 	}
 	
-	inline std::vector<Vertex> clipTriangleToFrustum(const std::vector<Vertex>& verts) {
-		std::vector<Vertex> clippedPolygon = clipPolygonToPlane(verts, left);
-		clippedPolygon = clipPolygonToPlane(clippedPolygon, right);
-		clippedPolygon = clipPolygonToPlane(clippedPolygon, top);
-		clippedPolygon = clipPolygonToPlane(clippedPolygon, bottom);
-		clippedPolygon = clipPolygonToPlane(clippedPolygon, near);
-		return clipPolygonToPlane(clippedPolygon, far);
+	template <typename Varyings>
+	inline void clipTriangleToGuardBand(const Varyings (&verts)[3], float guardBand, ClippedPolygon<Varyings>& clippedPolygon) {
+		for (const Varyings& v : verts) {
+			if (!isVertexInsideGuardBand(v.position, guardBand)) {
+				clipTriangleToFrustum(verts, clippedPolygon);
+				return;
+			}
+		}
+		// the guard band is convex, so vertices created on the near and far planes stay inside of it
+		static const ClipPlane planes[] = {near, far};
+		std::copy(verts, verts + 3, clippedPolygon.verts);
+		clippedPolygon.count = 3;
+		clipPolygonToPlanes(clippedPolygon, planes);
 	}
 	
 	inline bool cullFace(const glm::vec4& p0, const glm::vec4& p1, const glm::vec4& p2) {
@@ -226,6 +372,118 @@ namespace renderlib {
 		return deltaXE1*deltaYE2 - deltaYE1*deltaXE2 <= 0;
 	}
 
+	// signed doubled area of the triangle (a, b, p), positive when p lies left of the edge a->b
+	inline float edgeFunction(const glm::vec4& a, const glm::vec4& b, const glm::vec2& p) {
+		return (b.x - a.x)*(p.y - a.y) - (b.y - a.y)*(p.x - a.x);
+	}
+
+	// window coordinates are snapped to a 28.4 fixed point grid before rasterization
+	const int subpixelBits = 4;
+	const int subpixelSteps = 1 << subpixelBits;
+	
+	inline float snapToSubpixelGrid(float v) {
+		return std::round(v*subpixelSteps)/subpixelSteps;
+	}
+	
+	inline glm::ivec2 toFixedPoint(const glm::vec4& v) {
+		return {static_cast<int32_t>(std::round(v.x*subpixelSteps)), static_cast<int32_t>(std::round(v.y*subpixelSteps))};
+	}
+	
+	inline int64_t fixedPointArea(const glm::ivec2& a, const glm::ivec2& b, const glm::ivec2& c) {
+		return static_cast<int64_t>(b.x - a.x)*(c.y - a.y) - static_cast<int64_t>(b.y - a.y)*(c.x - a.x);
+	}
+	
+	// window y points up, so for counter-clockwise triangles left edges run downwards and top edges run to the left
+	inline bool isTopLeftEdge(const glm::ivec2& a, const glm::ivec2& b) {
+		return (a.y > b.y) || (a.y == b.y && a.x > b.x);
+	}
+	
+	// Edge a->b of a triangle on the 28.4 grid, sampled at integer pixel positions. Because the samples have
+	// no fractional part the edge function can be divided by the subpixel steps without changing its sign,
+	// which keeps the stepped value in 32 bits. The top-left rule is folded into the value, so a pixel is
+	// covered exactly when the value is not negative.
+	struct FixedPointEdge {
+		int32_t stepX;
+		int32_t stepY;
+		int32_t value;
+	};
+	
+	inline FixedPointEdge setupFixedPointEdge(const glm::ivec2& a, const glm::ivec2& b, int originX, int originY) {
+		int64_t deltaX = b.x - a.x;
+		int64_t deltaY = b.y - a.y;
+		int64_t c = deltaX*a.y - deltaY*a.x;
+		// covered when subpixelSteps*(deltaX*y - deltaY*x) > c, or >= c on a top-left edge
+		int64_t threshold = (isTopLeftEdge(a, b) ? c - 1 : c) >> subpixelBits;
+		FixedPointEdge edge;
+		edge.stepX = static_cast<int32_t>(-deltaY);
+		edge.stepY = static_cast<int32_t>(deltaX);
+		edge.value = static_cast<int32_t>(deltaX*originY - deltaY*originX - threshold - 1);
+		return edge;
+	}
+
+	// the edge function is linear, so over a square block of samples it takes its extremes at two of the corners.
+	// The bounds are relative to the value at the lower left sample of the block.
+	struct EdgeBlockBounds {
+		int32_t minimum;
+		int32_t maximum;
+	};
+
+	inline EdgeBlockBounds edgeBlockBounds(const FixedPointEdge& edge, int blockSize) {
+		return {
+			(std::min(edge.stepX, 0) + std::min(edge.stepY, 0))*(blockSize - 1),
+			(std::max(edge.stepX, 0) + std::max(edge.stepY, 0))*(blockSize - 1)
+		};
+	}
+
+	// screen space plane equations of all floats of a vertex layout: value(x, y) = anchor + (x-x0)*gradientX + (y-y0)*gradientY
+	template <typename Varyings>
+	struct AttributePlanes {
+		Varyings anchor;
+		Varyings gradientX;
+		Varyings gradientY;
+	};
+	
+	template <typename Varyings>
+	inline AttributePlanes<Varyings> setupAttributePlanes(const Varyings& v0, const Varyings& v1, const Varyings& v2) {
+		typedef VertexLayout<Varyings> Layout;
+		float x1 = v1.position.x - v0.position.x, y1 = v1.position.y - v0.position.y;
+		float x2 = v2.position.x - v0.position.x, y2 = v2.position.y - v0.position.y;
+		float oneOverArea = 1.f/(x1*y2 - x2*y1);
+		float ddx1 = y2*oneOverArea, ddx2 = -y1*oneOverArea;
+		float ddy1 = -x2*oneOverArea, ddy2 = x1*oneOverArea;
+		AttributePlanes<Varyings> planes;
+		planes.anchor = v0;
+		float* gradientX = Layout::floats(planes.gradientX);
+		float* gradientY = Layout::floats(planes.gradientY);
+		for (int i = 0; i < Layout::floatCount; ++i) {
+			const float delta1 = Layout::floats(v1)[i] - Layout::floats(v0)[i];
+			const float delta2 = Layout::floats(v2)[i] - Layout::floats(v0)[i];
+			gradientX[i] = delta1*ddx1 + delta2*ddx2;
+			gradientY[i] = delta1*ddy1 + delta2*ddy2;
+		}
+		return planes;
+	}
+	
+	template <typename Varyings>
+	inline Varyings evaluateAttributePlanes(const AttributePlanes<Varyings>& planes, float x, float y) {
+		typedef VertexLayout<Varyings> Layout;
+		float dx = x - planes.anchor.position.x;
+		float dy = y - planes.anchor.position.y;
+		Varyings v;
+		float* value = Layout::floats(v);
+		UnrolledLoop<0, Layout::floatCount>::run([&](int i) {
+			value[i] = Layout::floats(planes.anchor)[i] + Layout::floats(planes.gradientX)[i]*dx + Layout::floats(planes.gradientY)[i]*dy;
+		});
+		return v;
+	}
+	
+	// smallest depth the plane takes on a square block of samples with its lower left sample at (x, y)
+	template <typename Varyings>
+	inline float minimumBlockDepth(const AttributePlanes<Varyings>& planes, int x, int y, int blockSize) {
+		float depth = planes.anchor.position.z + planes.gradientX.position.z*(x - planes.anchor.position.x) + planes.gradientY.position.z*(y - planes.anchor.position.y);
+		return depth + (std::min(planes.gradientX.position.z, 0.f) + std::min(planes.gradientY.position.z, 0.f))*(blockSize - 1);
+	}
+
 }
 
 #endif /* renderlib_h */
@@ -2,14 +2,119 @@
 #import <XCTest/XCTest.h>
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
+#include <atomic>
+#include <random>
 #include <tuple>
 #include <vector>
 #include "renderlib.hpp"
+#include "Renderer.hpp"
+#include "CommandList.hpp"
+#include "Sampler.hpp"
 
 using namespace glm;
 using namespace renderlib;
 using namespace std;
 
+struct PassThroughVertexShader {
+	Vertex operator()(const Vertex& vertex) const {
+		return vertex;
+	}
+};
+
+struct CountingVertexShader {
+	unsigned int* callCount;
+	Vertex operator()(const Vertex& vertex) const {
+		++*callCount;
+		return vertex;
+	}
+};
+
+struct VertexColorPixelShader {
+	vec4 operator()(const Vertex& fragment) const {
+		return fragment.color;
+	}
+};
+
+struct CountingPixelShader {
+	unsigned int* callCount;
+	vec4 operator()(const Vertex& fragment) const {
+		++*callCount;
+		return fragment.color;
+	}
+};
+
+// counts fragments shaded on several threads
+struct AtomicCountingPixelShader {
+	std::atomic<unsigned int>* callCount;
+	vec4 operator()(const Vertex& fragment) const {
+		++*callCount;
+		return fragment.color;
+	}
+};
+
+// vertex layouts with fewer and with other varyings than Vertex
+struct ClipPosition {
+	vec4 position;
+};
+
+struct NormalVertex {
+	vec4 position;
+	vec3 normal;
+};
+
+// samples the texture bound to the renderer when the fragment is shaded
+struct BoundTexturePixelShader {
+	const Renderer* renderer;
+	vec4 operator()(const Vertex& fragment) const {
+		return Sampler(*renderer->texture()).lookup(fragment.texCoords);
+	}
+};
+
+// count triangles with random clip space positions and colors, partly outside of the view volume
+static vector<Vertex> triangleSoup(unsigned int count) {
+	std::minstd_rand random(1);
+	std::uniform_real_distribution<float> position(-1.2f, 1.2f), depth(0.05f, 0.95f), w(1.f, 3.f), color(0.f, 1.f);
+	vector<Vertex> vertexes;
+	for (unsigned int i = 0; i < count*3; ++i) {
+		const float vertexW = w(random);
+		vertexes.push_back({{position(random)*vertexW, position(random)*vertexW, depth(random)*vertexW, vertexW}, {color(random), color(random), color(random), 1.f}});
+	}
+	return vertexes;
+}
+
+static vector<uint32_t> sequentialIndices(size_t count) {
+	vector<uint32_t> indices(count);
+	for (size_t i = 0; i < count; ++i) {
+		indices[i] = static_cast<uint32_t>(i);
+	}
+	return indices;
+}
+
+// window y points up, the framebuffer stores the top row first
+static Pixel pixelAt(const Renderer& renderer, size_t x, size_t y) {
+	const Framebuffer& frameBuffer = renderer.frameBuffer();
+	return static_cast<const Pixel*>(frameBuffer.pixelData())[(frameBuffer.getHeight() - 1 - y)*frameBuffer.getWidth() + x];
+}
+
+static vector<uint8_t> framebufferBytes(const Renderer& renderer) {
+	const Framebuffer& frameBuffer = renderer.frameBuffer();
+	const uint8_t* pixels = static_cast<const uint8_t*>(frameBuffer.pixelData());
+	return vector<uint8_t>(pixels, pixels + frameBuffer.getBytesPerRow()*frameBuffer.getHeight());
+}
+
+// renders a frame of triangleCount triangles after setup has bound the buffers and render state
+template <typename PixelShader = VertexColorPixelShader>
+static vector<uint8_t> renderTriangles(uint32_t triangleCount, const std::function<void (Renderer& renderer)>& setup, const PixelShader& pixelShader = PixelShader()) {
+	Renderer renderer(200, 150);
+	renderer.disableCulling();
+	setup(renderer);
+	renderer.setRenderFunc([&](Renderer& renderer) {
+		renderer.drawTriangles(0, triangleCount, PassThroughVertexShader(), pixelShader);
+	});
+	renderer.render();
+	return framebufferBytes(renderer);
+}
+
 @interface RendererTests : XCTestCase
 
 @end
@@ -146,4 +251,805 @@ using namespace std;
 
 
 
+- (void)testFixedPointEdgesCoverSharedEdgePixelsExactlyOnce {
+	// two counter-clockwise triangles sharing the edge from a to c, which runs through pixel centers
+	ivec2 a = toFixedPoint(vec4(1.f, 1.f, 0, 1));
+	ivec2 b = toFixedPoint(vec4(9.5f, 1.25f, 0, 1));
+	ivec2 c = toFixedPoint(vec4(5.f, 9.f, 0, 1));
+	ivec2 d = toFixedPoint(vec4(-3.f, 6.f, 0, 1));
+	XCTAssertGreaterThan(fixedPointArea(a, b, c), 0);
+	XCTAssertGreaterThan(fixedPointArea(a, c, d), 0);
+	
+	FixedPointEdge edges[2][3] = {
+		{setupFixedPointEdge(b, c, 0, 0), setupFixedPointEdge(c, a, 0, 0), setupFixedPointEdge(a, b, 0, 0)},
+		{setupFixedPointEdge(c, d, 0, 0), setupFixedPointEdge(d, a, 0, 0), setupFixedPointEdge(a, c, 0, 0)}
+	};
+	for (int y = -4; y < 12; ++y) {
+		for (int x = -4; x < 12; ++x) {
+			int coverage = 0;
+			for (int t = 0; t < 2; ++t) {
+				bool inside = true;
+				for (int e = 0; e < 3; ++e) {
+					inside = inside && edges[t][e].value + x*edges[t][e].stepX + y*edges[t][e].stepY >= 0;
+				}
+				coverage += inside ? 1 : 0;
+			}
+			bool isOnSharedEdge = fixedPointArea(a, c, ivec2(x*subpixelSteps, y*subpixelSteps)) == 0;
+			if (isOnSharedEdge && y > 1 && y < 9) {
+				XCTAssertEqual(coverage, 1);
+			}
+			XCTAssertLessThanOrEqual(coverage, 1);
+		}
+	}
+}
+
+- (void)testEdgeBlockBoundsEncloseAllSamplesOfTheBlock {
+	const int blockSize = 8;
+	ivec2 a = toFixedPoint(vec4(-20.f, -3.5f, 0, 1));
+	ivec2 b = toFixedPoint(vec4(37.25f, 4.f, 0, 1));
+	ivec2 c = toFixedPoint(vec4(3.f, 29.75f, 0, 1));
+	FixedPointEdge edges[3] = {setupFixedPointEdge(b, c, 0, 0), setupFixedPointEdge(c, a, 0, 0), setupFixedPointEdge(a, b, 0, 0)};
+	for (const FixedPointEdge& edge : edges) {
+		EdgeBlockBounds bounds = edgeBlockBounds(edge, blockSize);
+		for (int blockY = -16; blockY < 32; blockY += blockSize) {
+			for (int blockX = -24; blockX < 40; blockX += blockSize) {
+				int32_t corner = edge.value + blockX*edge.stepX + blockY*edge.stepY;
+				int32_t minimum = std::numeric_limits<int32_t>::max();
+				int32_t maximum = std::numeric_limits<int32_t>::lowest();
+				for (int y = 0; y < blockSize; ++y) {
+					for (int x = 0; x < blockSize; ++x) {
+						int32_t value = corner + x*edge.stepX + y*edge.stepY;
+						minimum = std::min(minimum, value);
+						maximum = std::max(maximum, value);
+					}
+				}
+				XCTAssertEqual(corner + bounds.minimum, minimum);
+				XCTAssertEqual(corner + bounds.maximum, maximum);
+			}
+		}
+	}
+}
+
+- (void)testTrianglesInsideGuardBandAreNotClippedAgainstXAndY {
+	ClippedPolygon<Vertex> clippedPolygon;
+	// crosses the right plane but stays inside a guard band of twice the viewport
+	Vertex crossing[3] = {{{0.5f, 0, 0.5f, 1}}, {{1.5f, 0.5f, 0.5f, 1}}, {{0.5f, 0.8f, 0.5f, 1}}};
+	clipTriangleToGuardBand(crossing, 2, clippedPolygon);
+	XCTAssertEqual(clippedPolygon.count, 3);
+	clipTriangleToFrustum(crossing, clippedPolygon);
+	XCTAssertEqual(clippedPolygon.count, 4);
+	// leaves the guard band, so it is clipped to the frustum
+	Vertex leaving[3] = {{{0.5f, 0, 0.5f, 1}}, {{2.5f, 0.5f, 0.5f, 1}}, {{0.5f, 0.5f, 0.5f, 1}}};
+	clipTriangleToGuardBand(leaving, 2, clippedPolygon);
+	XCTAssertEqual(clippedPolygon.count, 4);
+	// crosses the near plane inside the guard band
+	Vertex nearCrossing[3] = {{{0, 0, -0.5f, 1}}, {{1.5f, 0, 0.5f, 1}}, {{0, 1.5f, 0.5f, 1}}};
+	clipTriangleToGuardBand(nearCrossing, 2, clippedPolygon);
+	XCTAssertEqual(clippedPolygon.count, 4);
+}
+
+- (void)testGuardBandIsClampedToTheRangeOfTheEdgeFunctions {
+	// a triangle reaching far outside of the viewport, which the rasterizer can only take after clipping
+	const vector<Vertex> vertexes = {{{-1000, -1000, 0.5f, 1}, {1, 0, 0, 1}}, {{1000, -1000, 0.5f, 1}, {1, 0, 0, 1}}, {{0, 1000, 0.5f, 1}, {1, 0, 0, 1}}};
+	vector<uint8_t> images[2];
+	for (int i = 0; i < 2; ++i) {
+		images[i] = renderTriangles(1, [&](Renderer& renderer) {
+			renderer.setRasterizer(halfSpace);
+			renderer.setVertexBuffer(vertexes);
+			renderer.setIndexBuffer({0, 1, 2});
+			if (i == 1) {
+				renderer.setGuardBand(1e6f);
+				XCTAssertEqual(renderer.guardBand(), renderer.maxGuardBand());
+				XCTAssertLessThanOrEqual(renderer.guardBand()*200, 8192);
+				renderer.setGuardBand(0.5f);
+				XCTAssertEqual(renderer.guardBand(), 1);
+				renderer.setGuardBand(1e6f);
+			}
+		});
+	}
+	XCTAssertTrue(images[0] == images[1]);
+	// the triangle covers the viewport
+	XCTAssertEqual(images[1][0], 255);
+	XCTAssertEqual(images[1][(149 - 75)*200*4 + 100*4], 255);
+}
+
+- (void)testTriangleCrossingAllPlanesIsClippedToNineVertices {
+	// a large triangle whose corners are cut by the four side planes and whose depth crosses near and far
+	Vertex verts[3] = {{{-3, -1.5f, -0.5f, 1}}, {{3, -1.5f, 0.5f, 1}}, {{0, 3, 1.5f, 1}}};
+	ClippedPolygon<Vertex> clippedPolygon;
+	clipTriangleToFrustum(verts, clippedPolygon);
+	XCTAssertLessThanOrEqual(clippedPolygon.count, maxClippedVertexCount);
+	XCTAssertGreaterThan(clippedPolygon.count, 3);
+	for (int i = 0; i < clippedPolygon.count; ++i) {
+		const vec4& p = clippedPolygon.verts[i].position;
+		XCTAssertLessThanOrEqual(fabs(p.x), p.w + 1e-5f);
+		XCTAssertLessThanOrEqual(fabs(p.y), p.w + 1e-5f);
+		XCTAssertLessThanOrEqual(-1e-5f, p.z);
+		XCTAssertLessThanOrEqual(p.z, p.w + 1e-5f);
+	}
+}
+
+- (void)testClipOutcodeHasOneBitPerPlaneTheVertexIsOutside {
+	XCTAssertEqual(clipOutcode(vec4(0, 0, 0.5f, 1)), 0);
+	XCTAssertEqual(clipOutcode(vec4(1, -1, 1, 1)), 0);
+	XCTAssertEqual(clipOutcode(vec4(-2, 0, 0.5f, 1)), 1 << left);
+	XCTAssertEqual(clipOutcode(vec4(2, 2, 0.5f, 1)), (1 << right) | (1 << bottom));
+	XCTAssertEqual(clipOutcode(vec4(0, -2, -0.5f, 1)), (1 << top) | (1 << near));
+	XCTAssertEqual(clipOutcode(vec4(0, 0, 2, 1)), 1 << far);
+}
+
+- (void)testVertexLayoutsInterpolateExactlyTheirOwnFloats {
+	XCTAssertEqual(VertexLayout<Vertex>::floatCount, 10);
+	XCTAssertEqual(VertexLayout<ClipPosition>::floatCount, 4);
+	XCTAssertEqual(VertexLayout<NormalVertex>::floatCount, 7);
+	NormalVertex verts[3] = {{{0, 0, 0.5f, 1}, {1, 0, 0}}, {{4, 0, 0.5f, 1}, {0, 1, 0}}, {{0, 4, 0.5f, 1}, {0, 0, 1}}};
+	const AttributePlanes<NormalVertex> planes = setupAttributePlanes(verts[0], verts[1], verts[2]);
+	const NormalVertex inside = evaluateAttributePlanes(planes, 1, 1);
+	XCTAssertEqualWithAccuracy(inside.normal.x, 0.5f, 1e-6f);
+	XCTAssertEqualWithAccuracy(inside.normal.y, 0.25f, 1e-6f);
+	XCTAssertEqualWithAccuracy(inside.normal.z, 0.25f, 1e-6f);
+	const NormalVertex between = clipVertex(verts[1], verts[2], 0.5f);
+	XCTAssertEqualWithAccuracy(between.position.x, 2, 1e-6f);
+	XCTAssertEqualWithAccuracy(between.normal.y, 0.5f, 1e-6f);
+	XCTAssertEqualWithAccuracy(between.normal.z, 0.5f, 1e-6f);
+}
+
+- (void)testLineCrossingNearPlaneIsClippedAtTheIntersection {
+	Vertex start = {{0, -0.5f, 0.5f, 1}};
+	Vertex end = {{0, 0.5f, -0.5f, 1}};
+	XCTAssertTrue(clipLineToFrustum(start, end));
+	XCTAssertEqualWithAccuracy(start.position.y, -0.5f, 1e-6f);
+	XCTAssertEqualWithAccuracy(end.position.y, 0, 1e-6f);
+	XCTAssertEqualWithAccuracy(end.position.z, 0, 1e-6f);
+	
+	Vertex outsideStart = {{2, -0.5f, 0.5f, 1}};
+	Vertex outsideEnd = {{3, 0.5f, 0.5f, 1}};
+	XCTAssertFalse(clipLineToFrustum(outsideStart, outsideEnd));
+}
+
+- (void)testThreadedRenderingMatchesSerialRendering {
+	const vector<Vertex> soup = triangleSoup(300);
+	const vector<uint32_t> indices = sequentialIndices(soup.size());
+	for (RasterizerType rasterizer : {scanline, halfSpace}) {
+		vector<uint8_t> images[2];
+		std::atomic<unsigned int> fragmentCounts[2] = {{0}, {0}};
+		for (int i = 0; i < 2; ++i) {
+			images[i] = renderTriangles(300, [&](Renderer& renderer) {
+				renderer.setRasterizer(rasterizer);
+				renderer.setThreadCount(i == 0 ? 1 : 8);
+				renderer.setVertexBuffer(soup);
+				renderer.setIndexBuffer(indices);
+			}, AtomicCountingPixelShader{&fragmentCounts[i]});
+		}
+		XCTAssertTrue(images[0] == images[1]);
+		XCTAssertTrue(std::count(images[0].begin(), images[0].end(), 0) < images[0].size()/2);
+		// triangles crossing tile borders are split between the tiles, so no fragment is shaded twice
+		XCTAssertEqual(fragmentCounts[0].load(), fragmentCounts[1].load());
+	}
+}
+
+- (void)testVertexShaderRunsOncePerVertexOfADraw {
+	// a grid of 4x4 quads, the 25 vertices are shared by up to six of the 32 triangles
+	vector<Vertex> vertexes;
+	for (int y = 0; y <= 4; ++y) {
+		for (int x = 0; x <= 4; ++x) {
+			vertexes.push_back({{x/2.f - 1, y/2.f - 1, 0.5f, 1}, {1, 1, 1, 1}});
+		}
+	}
+	vector<uint32_t> indices;
+	for (uint32_t y = 0; y < 4; ++y) {
+		for (uint32_t x = 0; x < 4; ++x) {
+			const uint32_t corner = y*5 + x;
+			indices.insert(indices.end(), {corner, corner + 1, corner + 6, corner, corner + 6, corner + 5});
+		}
+	}
+	unsigned int callCount = 0;
+	Renderer renderer(64, 64);
+	renderer.setVertexBuffer(vertexes);
+	renderer.setIndexBuffer(indices);
+	renderer.setRenderFunc([&](Renderer& renderer) {
+		renderer.drawTriangles(0, 32, CountingVertexShader{&callCount}, VertexColorPixelShader());
+		renderer.drawTriangles(0, 2, CountingVertexShader{&callCount}, VertexColorPixelShader());
+	});
+	renderer.render();
+	XCTAssertEqual(callCount, 25 + 4);
+}
+
+- (void)testImmediateDrawHidesDeferredDrawBehindIt {
+	// a red quad covering the viewport at depth 0.8 and a green one covering the left half at depth 0.2
+	vector<Vertex> vertexes = {
+		{{-1, -1, 0.8f, 1}, {1, 0, 0, 1}}, {{1, -1, 0.8f, 1}, {1, 0, 0, 1}}, {{1, 1, 0.8f, 1}, {1, 0, 0, 1}}, {{-1, 1, 0.8f, 1}, {1, 0, 0, 1}},
+		{{-1, -1, 0.2f, 1}, {0, 1, 0, 1}}, {{0, -1, 0.2f, 1}, {0, 1, 0, 1}}, {{0, 1, 0.2f, 1}, {0, 1, 0, 1}}, {{-1, 1, 0.2f, 1}, {0, 1, 0, 1}}
+	};
+	Renderer renderer(32, 32);
+	renderer.setVertexBuffer(vertexes);
+	renderer.setIndexBuffer({0, 1, 2, 0, 2, 3, 4, 5, 6, 4, 6, 7});
+	renderer.setRenderFunc([](Renderer& renderer) {
+		renderer.enableDeferredShading();
+		renderer.drawTriangles(0, 2, PassThroughVertexShader(), VertexColorPixelShader());
+		renderer.disableDeferredShading();
+		renderer.drawTriangles(6, 2, PassThroughVertexShader(), VertexColorPixelShader());
+	});
+	renderer.render();
+	XCTAssertEqual(pixelAt(renderer, 8, 16).g, 255);
+	XCTAssertEqual(pixelAt(renderer, 8, 16).r, 0);
+	XCTAssertEqual(pixelAt(renderer, 24, 16).r, 255);
+}
+
+- (void)testDeferredShadingCanBeTurnedOffAndOnBetweenFrames {
+	// every frame draws the same soup, deferred in the first and last frame only
+	const vector<Vertex> soup = triangleSoup(100);
+	Renderer renderer(64, 64);
+	renderer.disableCulling();
+	renderer.setVertexBuffer(soup);
+	renderer.setIndexBuffer(sequentialIndices(soup.size()));
+	renderer.setRenderFunc([](Renderer& renderer) {
+		renderer.drawTriangles(0, 100, PassThroughVertexShader(), VertexColorPixelShader());
+	});
+	vector<uint8_t> images[3];
+	for (int frame = 0; frame < 3; ++frame) {
+		if (frame == 1) {
+			renderer.disableDeferredShading();
+		}
+		else {
+			renderer.enableDeferredShading();
+		}
+		renderer.render();
+		images[frame] = framebufferBytes(renderer);
+	}
+	XCTAssertTrue(images[0] == images[1]);
+	XCTAssertTrue(images[0] == images[2]);
+}
+
+- (void)testDeferredDrawsAreShadedWithTheirOwnTextures {
+	// a red textured quad on the left and a cyan textured one on the right, the shader samples the bound texture
+	const vector<Vertex> vertexes = {
+		{{-1, -1, 0.5f, 1}, {}, {0, 0}}, {{0, -1, 0.5f, 1}, {}, {1, 0}}, {{0, 1, 0.5f, 1}, {}, {1, 1}}, {{-1, 1, 0.5f, 1}, {}, {0, 1}},
+		{{0, -1, 0.5f, 1}, {}, {0, 0}}, {{1, -1, 0.5f, 1}, {}, {1, 0}}, {{1, 1, 0.5f, 1}, {}, {1, 1}}, {{0, 1, 0.5f, 1}, {}, {0, 1}}
+	};
+	const TextureHandle textures[2] = {
+		std::make_shared<const Texture>(vector<Pixel>(4, {255, 0, 0, 255}), 2, 2),
+		std::make_shared<const Texture>(vector<Pixel>(4, {0, 255, 255, 255}), 2, 2)
+	};
+	vector<uint8_t> images[2];
+	for (int deferred = 0; deferred < 2; ++deferred) {
+		Renderer renderer(32, 32);
+		renderer.setVertexBuffer(vertexes);
+		renderer.setIndexBuffer({0, 1, 2, 0, 2, 3, 4, 5, 6, 4, 6, 7});
+		if (deferred) {
+			renderer.enableDeferredShading();
+		}
+		renderer.setRenderFunc([&](Renderer& renderer) {
+			renderer.setTexture(textures[0]);
+			renderer.drawTriangles(0, 2, PassThroughVertexShader(), BoundTexturePixelShader{&renderer});
+			renderer.setTexture(textures[1]);
+			renderer.drawTriangles(6, 2, PassThroughVertexShader(), BoundTexturePixelShader{&renderer});
+		});
+		renderer.render();
+		images[deferred] = framebufferBytes(renderer);
+		XCTAssertEqual(pixelAt(renderer, 8, 16).r, 255);
+		XCTAssertEqual(pixelAt(renderer, 8, 16).g, 0);
+		XCTAssertEqual(pixelAt(renderer, 24, 16).r, 0);
+		XCTAssertEqual(pixelAt(renderer, 24, 16).g, 255);
+		// the texture bound at the end of the frame is bound again after the resolve
+		XCTAssertTrue(renderer.texture() == textures[1]);
+	}
+	XCTAssertTrue(images[0] == images[1]);
+}
+
+- (void)testSortedDrawsMatchSubmissionOrderAndShadeFewerPixels {
+	// three viewport sized quads submitted back to front, the nearest one only covers the left half
+	vector<Vertex> vertexes = {
+		{{-1, -1, 0.8f, 1}, {1, 0, 0, 1}}, {{1, -1, 0.8f, 1}, {1, 0, 0, 1}}, {{1, 1, 0.8f, 1}, {1, 0, 0, 1}}, {{-1, 1, 0.8f, 1}, {1, 0, 0, 1}},
+		{{-1, -1, 0.5f, 1}, {0, 0, 1, 1}}, {{1, -1, 0.5f, 1}, {0, 0, 1, 1}}, {{1, 1, 0.5f, 1}, {0, 0, 1, 1}}, {{-1, 1, 0.5f, 1}, {0, 0, 1, 1}},
+		{{-1, -1, 0.2f, 1}, {0, 1, 0, 1}}, {{0, -1, 0.2f, 1}, {0, 1, 0, 1}}, {{0, 1, 0.2f, 1}, {0, 1, 0, 1}}, {{-1, 1, 0.2f, 1}, {0, 1, 0, 1}}
+	};
+	const vector<uint32_t> indices = {0, 1, 2, 0, 2, 3, 4, 5, 6, 4, 6, 7, 8, 9, 10, 8, 10, 11};
+	vector<uint8_t> images[2];
+	unsigned int callCounts[2] = {0, 0};
+	for (int sorted = 0; sorted < 2; ++sorted) {
+		Renderer renderer(32, 32);
+		renderer.setRasterizer(halfSpace);
+		renderer.setVertexBuffer(vertexes);
+		renderer.setIndexBuffer(indices);
+		if (sorted) {
+			renderer.enableDrawSorting();
+		}
+		unsigned int* callCount = &callCounts[sorted];
+		renderer.setRenderFunc([=](Renderer& renderer) {
+			for (uint32_t quad = 0; quad < 3; ++quad) {
+				renderer.drawTriangles(quad*6, 2, PassThroughVertexShader(), CountingPixelShader{callCount});
+			}
+		});
+		renderer.render();
+		images[sorted] = framebufferBytes(renderer);
+	}
+	XCTAssertTrue(images[0] == images[1]);
+	// the quads cover 31x31 pixels, front to back every one of them is shaded once
+	XCTAssertEqual(callCounts[1], 31*31);
+	XCTAssertGreaterThan(callCounts[0], 2*callCounts[1]);
+}
+
+- (void)testDeferredShadingAndLinesFollowTheViewportSize {
+	vector<Vertex> vertexes = {
+		{{-1, -1, 0.8f, 1}, {1, 0, 0, 1}}, {{1, -1, 0.8f, 1}, {1, 0, 0, 1}}, {{1, 1, 0.8f, 1}, {1, 0, 0, 1}}, {{-1, 1, 0.8f, 1}, {1, 0, 0, 1}},
+		{{-1, 0, 0.2f, 1}, {0, 1, 0, 1}}, {{1, 0, 0.2f, 1}, {0, 1, 0, 1}}
+	};
+	Renderer renderer(16, 16);
+	renderer.setVertexBuffer(vertexes);
+	renderer.setIndexBuffer({0, 1, 2, 0, 2, 3, 4, 5});
+	renderer.setRenderFunc([](Renderer& renderer) {
+		renderer.enableDeferredShading();
+		renderer.drawTriangles(0, 2, PassThroughVertexShader(), VertexColorPixelShader());
+		renderer.drawLines(6, 1, PassThroughVertexShader());
+	});
+	renderer.render();
+	renderer.setViewport(0, 0, 64, 64);
+	renderer.render();
+	XCTAssertEqual(pixelAt(renderer, 60, 32).g, 255);
+	XCTAssertEqual(pixelAt(renderer, 60, 40).r, 255);
+	XCTAssertEqual(pixelAt(renderer, 4, 4).r, 255);
+}
+
+- (void)testGridRendersIdenticallyAsListStripsAndFans {
+	// 4x4 quads, strips run along the rows and fans around every quad, both ended by the restart index
+	vector<Vertex> vertexes;
+	for (int y = 0; y <= 4; ++y) {
+		for (int x = 0; x <= 4; ++x) {
+			vertexes.push_back({{x/2.f - 1, y/2.f - 1, 0.3f + 0.1f*x, 1}, {x/4.f, y/4.f, 0.5f, 1}});
+		}
+	}
+	const uint32_t restartIndex = 0xffffffff;
+	vector<uint32_t> list, strips, fans;
+	for (uint32_t y = 0; y < 4; ++y) {
+		for (uint32_t x = 0; x <= 4; ++x) {
+			strips.insert(strips.end(), {(y + 1)*5 + x, y*5 + x});
+		}
+		strips.push_back(restartIndex);
+		for (uint32_t x = 0; x < 4; ++x) {
+			const uint32_t corner = y*5 + x;
+			list.insert(list.end(), {corner, corner + 1, corner + 6, corner, corner + 6, corner + 5});
+			fans.insert(fans.end(), {corner, corner + 1, corner + 6, corner + 5, restartIndex});
+		}
+	}
+	const PrimitiveTopology topologies[3] = {triangleList, triangleStrip, triangleFan};
+	const vector<uint32_t>* indices[3] = {&list, &strips, &fans};
+	vector<uint8_t> images[3];
+	for (int i = 0; i < 3; ++i) {
+		Renderer renderer(48, 48);
+		renderer.setRasterizer(halfSpace);
+		renderer.setPrimitiveTopology(topologies[i]);
+		renderer.enablePrimitiveRestart(restartIndex);
+		renderer.setVertexBuffer(vertexes);
+		renderer.setIndexBuffer(*indices[i]);
+		const uint32_t count = i == 0 ? 32 : static_cast<uint32_t>(indices[i]->size());
+		renderer.setRenderFunc([=](Renderer& renderer) {
+			renderer.drawTriangles(0, count, PassThroughVertexShader(), VertexColorPixelShader());
+		});
+		renderer.render();
+		images[i] = framebufferBytes(renderer);
+	}
+	XCTAssertTrue(images[0] == images[1]);
+	XCTAssertTrue(images[0] == images[2]);
+}
+
+- (void)testPrimitiveRestartDoesNotApplyToTriangleLists {
+	vector<Vertex> vertexes = {{{0, -1, 0.5f, 1}, {1, 0, 0, 1}}, {{1, 1, 0.5f, 1}, {1, 0, 0, 1}}, {{-1, 1, 0.5f, 1}, {1, 0, 0, 1}}};
+	Renderer renderer(16, 16);
+	renderer.enablePrimitiveRestart(0);
+	renderer.setVertexBuffer(vertexes);
+	renderer.setIndexBuffer({0, 1, 2});
+	renderer.setRenderFunc([](Renderer& renderer) {
+		renderer.drawTriangles(0, 1, PassThroughVertexShader(), VertexColorPixelShader());
+	});
+	renderer.render();
+	XCTAssertEqual(pixelAt(renderer, 7, 2).r, 255);
+}
+
+- (void)testShortIndicesRenderLikeFullIndices {
+	// the soup sits at the end of 65536 vertexes, its last triangle is a red one in front of the center that uses
+	// vertex 0xffff, which is an ordinary vertex while primitive restart is disabled
+	vector<Vertex> soup = triangleSoup(100);
+	soup.resize(soup.size() - 3);
+	soup.push_back({{-1, -1, 0.01f, 1}, {1, 0, 0, 1}});
+	soup.push_back({{1, -1, 0.01f, 1}, {1, 0, 0, 1}});
+	soup.push_back({{0, 1, 0.01f, 1}, {1, 0, 0, 1}});
+	vector<Vertex> vertexes(65536 - soup.size());
+	vertexes.insert(vertexes.end(), soup.begin(), soup.end());
+	vector<uint32_t> indices;
+	for (size_t i = vertexes.size() - soup.size(); i < vertexes.size(); ++i) {
+		indices.push_back(static_cast<uint32_t>(i));
+	}
+	XCTAssertEqual(indices.back(), 0xffff);
+	vector<uint8_t> images[2];
+	for (int i = 0; i < 2; ++i) {
+		images[i] = renderTriangles(100, [&](Renderer& renderer) {
+			renderer.setVertexBuffer(vertexes);
+			if (i == 0) {
+				renderer.setIndexBuffer(indices);
+			}
+			else {
+				renderer.setIndexBuffer(vector<uint16_t>(indices.begin(), indices.end()));
+			}
+		});
+	}
+	XCTAssertTrue(images[0] == images[1]);
+	const uint8_t* center = &images[1][(149 - 75)*200*4 + 100*4];
+	XCTAssertEqual(center[0], 255);
+	XCTAssertEqual(center[1], 0);
+}
+
+- (void)testBuffersBoundByHandleAreSharedAndRenderLikeCopies {
+	const vector<Vertex> soup = triangleSoup(100);
+	const VertexBufferHandle vertexBuffer = std::make_shared<const vector<Vertex>>(soup);
+	const IndexBufferHandle indexBuffer = std::make_shared<const vector<uint32_t>>(sequentialIndices(soup.size()));
+	vector<uint8_t> images[2];
+	for (int i = 0; i < 2; ++i) {
+		images[i] = renderTriangles(100, [&](Renderer& renderer) {
+			if (i == 0) {
+				// the vector overloads bind copies
+				renderer.setVertexBuffer(*vertexBuffer);
+				renderer.setIndexBuffer(*indexBuffer);
+				XCTAssertEqual(vertexBuffer.use_count(), 1);
+				XCTAssertTrue(renderer.vertexBuffer().get() != vertexBuffer.get());
+				XCTAssertTrue(renderer.indexBuffer() != indexBuffer);
+			}
+			else {
+				// the handle overloads share the buffers
+				renderer.setVertexBuffer(vertexBuffer);
+				renderer.setIndexBuffer(indexBuffer);
+				XCTAssertEqual(vertexBuffer.use_count(), 2);
+				XCTAssertEqual(indexBuffer.use_count(), 2);
+				XCTAssertTrue(renderer.vertexBuffer().get() == vertexBuffer.get());
+				XCTAssertTrue(renderer.indexBuffer() == indexBuffer);
+			}
+		});
+	}
+	XCTAssertTrue(images[0] == images[1]);
+	XCTAssertEqual(vertexBuffer.use_count(), 1);
+	XCTAssertEqual(indexBuffer.use_count(), 1);
+}
+
+- (void)testInstancedDrawMatchesOneDrawPerInstance {
+	// one quad, every instance moves it to another cell of a 4x4 grid
+	vector<Vertex> vertexes = {
+		{{0, 0, 0.5f, 1}, {1, 0, 0, 1}}, {{0.5f, 0, 0.5f, 1}, {0, 1, 0, 1}}, {{0.5f, 0.5f, 0.5f, 1}, {0, 0, 1, 1}}, {{0, 0.5f, 0.5f, 1}, {1, 1, 1, 1}}
+	};
+	vector<vec4> offsets;
+	for (int i = 0; i < 16; ++i) {
+		offsets.push_back({(i % 4)/2.f - 1, (i / 4)/2.f - 1, 0, 0});
+	}
+	vector<uint8_t> images[2];
+	unsigned int callCounts[2] = {0, 0};
+	for (int instanced = 0; instanced < 2; ++instanced) {
+		Renderer renderer(64, 64);
+		renderer.setVertexBuffer(vertexes);
+		renderer.setIndexBuffer({0, 1, 2, 0, 2, 3});
+		unsigned int* callCount = &callCounts[instanced];
+		renderer.setRenderFunc([&, callCount, instanced](Renderer& renderer) {
+			if (instanced) {
+				renderer.drawTrianglesInstanced(0, 2, 16, [&, callCount](const Vertex& vertex, uint32_t instance) {
+					++*callCount;
+					return Vertex{vertex.position + offsets[instance], vertex.color};
+				}, VertexColorPixelShader());
+				return;
+			}
+			for (const vec4& offset : offsets) {
+				renderer.drawTriangles(0, 2, [&, callCount](const Vertex& vertex) {
+					++*callCount;
+					return Vertex{vertex.position + offset, vertex.color};
+				}, VertexColorPixelShader());
+			}
+		});
+		renderer.render();
+		images[instanced] = framebufferBytes(renderer);
+	}
+	XCTAssertTrue(images[0] == images[1]);
+	XCTAssertEqual(callCounts[0], 4*16);
+	XCTAssertEqual(callCounts[1], 4*16);
+}
+
+- (void)testInstancedDrawWithoutPixelShaderOnlyWritesDepth {
+	vector<Vertex> vertexes = {
+		{{-1, -1, 0.2f, 1}, {0, 1, 0, 1}}, {{1, -1, 0.2f, 1}, {0, 1, 0, 1}}, {{1, 1, 0.2f, 1}, {0, 1, 0, 1}}, {{-1, 1, 0.2f, 1}, {0, 1, 0, 1}},
+		{{-1, -1, 0.8f, 1}, {1, 0, 0, 1}}, {{1, -1, 0.8f, 1}, {1, 0, 0, 1}}, {{1, 1, 0.8f, 1}, {1, 0, 0, 1}}, {{-1, 1, 0.8f, 1}, {1, 0, 0, 1}}
+	};
+	Renderer renderer(16, 16);
+	renderer.setVertexBuffer(vertexes);
+	renderer.setIndexBuffer({0, 1, 2, 0, 2, 3, 4, 5, 6, 4, 6, 7});
+	renderer.setInstancedVertexShader([](const Vertex& vertex, uint32_t instance) {
+		return vertex;
+	});
+	renderer.setVertexShader(PassThroughVertexShader());
+	renderer.setRenderFunc([](Renderer& renderer) {
+		renderer.setPixelShader(nullptr);
+		renderer.drawTrianglesInstanced(0, 2, 1);
+		renderer.setPixelShader(VertexColorPixelShader());
+		renderer.drawTriangles(6, 2);
+	});
+	renderer.render();
+	XCTAssertEqual(pixelAt(renderer, 8, 8).r, 0);
+	XCTAssertEqual(pixelAt(renderer, 8, 8).g, 0);
+}
+
+- (void)testDepthOnlyDrawWritesDepthWithoutDepthTesting {
+	vector<Vertex> vertexes = {
+		{{-1, -1, 0.2f, 1}, {0, 1, 0, 1}}, {{1, -1, 0.2f, 1}, {0, 1, 0, 1}}, {{1, 1, 0.2f, 1}, {0, 1, 0, 1}}, {{-1, 1, 0.2f, 1}, {0, 1, 0, 1}},
+		{{-1, -1, 0.8f, 1}, {0, 0, 0, 1}}, {{1, -1, 0.8f, 1}, {0, 0, 0, 1}}, {{1, 1, 0.8f, 1}, {0, 0, 0, 1}}, {{-1, 1, 0.8f, 1}, {0, 0, 0, 1}},
+		{{-1, -1, 0.5f, 1}, {1, 0, 0, 1}}, {{1, -1, 0.5f, 1}, {1, 0, 0, 1}}, {{1, 1, 0.5f, 1}, {1, 0, 0, 1}}, {{-1, 1, 0.5f, 1}, {1, 0, 0, 1}}
+	};
+	for (RasterizerType rasterizer : {scanline, halfSpace}) {
+		Renderer renderer(32, 32);
+		renderer.setRasterizer(rasterizer);
+		renderer.setVertexBuffer(vertexes);
+		renderer.setIndexBuffer({0, 1, 2, 0, 2, 3, 4, 5, 6, 4, 6, 7, 8, 9, 10, 8, 10, 11});
+		renderer.setRenderFunc([](Renderer& renderer) {
+			renderer.drawTriangles(0, 2, PassThroughVertexShader(), VertexColorPixelShader());
+			// moves the depth of the green quad behind the red one
+			renderer.disableDepthTesting();
+			renderer.drawTrianglesDepthOnly(6, 2, PassThroughVertexShader());
+			renderer.enableDepthTesting();
+			renderer.drawTriangles(12, 2, PassThroughVertexShader(), VertexColorPixelShader());
+		});
+		renderer.render();
+		// the red quad is behind the block depth hierarchical z kept for the green quad, which has to be raised too
+		XCTAssertEqual(pixelAt(renderer, 12, 12).r, 255);
+		XCTAssertEqual(pixelAt(renderer, 12, 12).g, 0);
+	}
+}
+
+- (void)testCommandListReplaysRecordedStateAndDraws {
+	// two rows of quads as triangle strips, separated by a restart index
+	vector<Vertex> vertexes;
+	for (int y = 0; y <= 2; ++y) {
+		for (int x = 0; x <= 2; ++x) {
+			vertexes.push_back({{x - 1.f, y - 1.f, 0.5f, 1}, {x/2.f, y/2.f, 1, 1}});
+		}
+	}
+	const VertexBufferHandle vertexBuffer = std::make_shared<const vector<Vertex>>(vertexes);
+	const ShortIndexBufferHandle indexBuffer = std::make_shared<const vector<uint16_t>>(vector<uint16_t>{3, 0, 4, 1, 5, 2, 0xffff, 6, 3, 7, 4, 8, 5});
+	CommandList commandList;
+	commandList.setVertexBuffer(vertexBuffer);
+	commandList.setIndexBuffer(indexBuffer);
+	commandList.setPrimitiveTopology(triangleStrip);
+	commandList.enablePrimitiveRestart(0xffff);
+	commandList.setVertexShader(PassThroughVertexShader());
+	commandList.setPixelShader(VertexColorPixelShader());
+	commandList.drawTriangles(0, 13);
+	commandList.disablePrimitiveRestart();
+	commandList.setPrimitiveTopology(triangleList);
+	
+	Renderer direct(32, 32);
+	direct.setVertexBuffer(vertexBuffer);
+	direct.setIndexBuffer(indexBuffer);
+	direct.setPrimitiveTopology(triangleStrip);
+	direct.enablePrimitiveRestart(0xffff);
+	direct.setRenderFunc([](Renderer& renderer) {
+		renderer.drawTriangles(0, 13, PassThroughVertexShader(), VertexColorPixelShader());
+	});
+	direct.render();
+	
+	Renderer recorded(32, 32);
+	recorded.setRenderFunc([&](Renderer& renderer) {
+		renderer.execute(commandList);
+	});
+	recorded.render();
+	XCTAssertTrue(framebufferBytes(direct) == framebufferBytes(recorded));
+	XCTAssertEqual(recorded.primitiveTopology(), triangleList);
+	XCTAssertEqual(pixelAt(recorded, 16, 16).b, 255);
+}
+
+- (void)testAppendedCommandListsUseTheirOwnResources {
+	// the first list draws a red quad over the viewport, the second a nearer green one over the left half
+	const VertexBufferHandle farQuad = std::make_shared<const vector<Vertex>>(vector<Vertex>{
+		{{-1, -1, 0.8f, 1}, {1, 0, 0, 1}}, {{1, -1, 0.8f, 1}, {1, 0, 0, 1}}, {{1, 1, 0.8f, 1}, {1, 0, 0, 1}}, {{-1, 1, 0.8f, 1}, {1, 0, 0, 1}}
+	});
+	const VertexBufferHandle nearQuad = std::make_shared<const vector<Vertex>>(vector<Vertex>{
+		{{-1, -1, 0.2f, 1}, {0, 1, 0, 1}}, {{0, -1, 0.2f, 1}, {0, 1, 0, 1}}, {{0, 1, 0.2f, 1}, {0, 1, 0, 1}}, {{-1, 1, 0.2f, 1}, {0, 1, 0, 1}}
+	});
+	const IndexBufferHandle indexBuffer = std::make_shared<const vector<uint32_t>>(vector<uint32_t>{0, 1, 2, 0, 2, 3});
+	CommandList lists[2];
+	for (int i = 0; i < 2; ++i) {
+		lists[i].setVertexBuffer(i == 0 ? farQuad : nearQuad);
+		lists[i].setIndexBuffer(indexBuffer);
+		lists[i].setVertexShader(PassThroughVertexShader());
+		lists[i].setPixelShader(VertexColorPixelShader());
+		lists[i].drawTriangles(0, 2);
+	}
+	CommandList merged;
+	merged.append(lists[0]);
+	merged.append(lists[1]);
+	
+	Renderer renderer(32, 32);
+	renderer.setRenderFunc([&](Renderer& renderer) {
+		renderer.execute(merged);
+	});
+	renderer.render();
+	XCTAssertEqual(pixelAt(renderer, 8, 16).g, 255);
+	XCTAssertEqual(pixelAt(renderer, 24, 16).r, 255);
+	const vector<uint8_t> image = framebufferBytes(renderer);
+	renderer.setRenderFunc([&](Renderer& renderer) {
+		renderer.execute(vector<CommandList>(lists, lists + 2));
+	});
+	renderer.render();
+	XCTAssertTrue(image == framebufferBytes(renderer));
+}
+
+- (void)testCommandListAppendedToItselfReplaysTwice {
+	vector<Vertex> vertexes = {{{-1, -1, 0.5f, 1}, {1, 0, 0, 1}}, {{1, -1, 0.5f, 1}, {1, 0, 0, 1}}, {{-1, 1, 0.5f, 1}, {1, 0, 0, 1}}};
+	unsigned int callCount = 0;
+	CommandList commandList;
+	commandList.setVertexBuffer(std::make_shared<const vector<Vertex>>(vertexes));
+	commandList.setIndexBuffer(std::make_shared<const vector<uint32_t>>(vector<uint32_t>{0, 1, 2}));
+	commandList.drawTriangles(0, 1, CountingVertexShader{&callCount}, VertexColorPixelShader());
+	commandList.append(commandList);
+	
+	Renderer renderer(16, 16);
+	renderer.setRenderFunc([&](Renderer& renderer) {
+		renderer.execute(commandList);
+	});
+	renderer.render();
+	XCTAssertEqual(callCount, 6);
+	XCTAssertEqual(pixelAt(renderer, 2, 2).r, 255);
+}
+
+- (void)testDrawsSortedByStateKeepTheirTextures {
+	// eight overlapping quads at decreasing depth, alternating between a red and a cyan texture and two shaders
+	vector<Vertex> vertexes;
+	for (int quad = 0; quad < 8; ++quad) {
+		const float left = quad/8.f - 1, depth = 0.9f - quad/10.f;
+		for (vec2 corner : {vec2(0, 0), vec2(1, 0), vec2(1, 1), vec2(0, 1)}) {
+			vertexes.push_back({{left + corner.x, corner.y*1.5f - 0.75f, depth, 1}, {corner.x, corner.y, 0.5f, 1}, corner});
+		}
+	}
+	const TextureHandle textures[2] = {
+		std::make_shared<const Texture>(vector<Pixel>(4, {255, 0, 0, 255}), 2, 2),
+		std::make_shared<const Texture>(vector<Pixel>(4, {0, 255, 255, 255}), 2, 2)
+	};
+	const vector<uint32_t> indices = {0, 1, 2, 0, 2, 3};
+	vector<uint8_t> images[3];
+	for (int mode = 0; mode < 3; ++mode) {
+		Renderer renderer(64, 64);
+		renderer.setVertexBuffer(vertexes);
+		if (mode > 0) {
+			renderer.enableDrawSorting();
+			renderer.setDrawSortOrder(mode == 1 ? sortByDepth : sortByState);
+		}
+		renderer.setRenderFunc([&](Renderer& renderer) {
+			for (uint32_t quad = 0; quad < 8; ++quad) {
+				vector<uint32_t> quadIndices;
+				for (uint32_t index : indices) {
+					quadIndices.push_back(quad*4 + index);
+				}
+				renderer.setIndexBuffer(quadIndices);
+				renderer.setTexture(textures[quad % 2]);
+				if (quad % 4 < 2) {
+					renderer.drawTriangles(0, 2, PassThroughVertexShader(), BoundTexturePixelShader{&renderer});
+				}
+				else {
+					renderer.drawTriangles(0, 2, PassThroughVertexShader(), VertexColorPixelShader());
+				}
+			}
+		});
+		renderer.render();
+		images[mode] = framebufferBytes(renderer);
+		XCTAssertTrue(renderer.texture() == textures[1]);
+	}
+	XCTAssertTrue(images[0] == images[1]);
+	XCTAssertTrue(images[0] == images[2]);
+	// the visible parts of the fifth and sixth quad are textured red and cyan
+	const uint8_t* red = &images[2][(63 - 32)*64*4 + 17*4];
+	const uint8_t* cyan = &images[2][(63 - 32)*64*4 + 21*4];
+	XCTAssertEqual(red[0], 255);
+	XCTAssertEqual(red[1], 0);
+	XCTAssertEqual(cyan[0], 0);
+	XCTAssertEqual(cyan[1], 255);
+}
+
+- (void)testNormalsRenderLikeTheSameValuesInVertexColors {
+	// the normals of a custom vertex layout are interpolated exactly like the colors of a Vertex holding the same values
+	const vector<Vertex> soup = triangleSoup(100);
+	vector<NormalVertex> normalSoup;
+	for (const Vertex& vertex : soup) {
+		normalSoup.push_back({vertex.position, vec3(vertex.color)});
+	}
+	const vector<uint32_t> indices = sequentialIndices(soup.size());
+	const auto colorPixelShader = [](const Vertex& fragment) {
+		return vec4(vec3(fragment.color), 1);
+	};
+	const auto normalVertexShader = [](const NormalVertex& vertex) {
+		return vertex;
+	};
+	const auto normalPixelShader = [](const NormalVertex& fragment) {
+		return vec4(fragment.normal, 1);
+	};
+	for (RasterizerType rasterizer : {scanline, halfSpace}) {
+		// immediate, deferred, sorted on several threads, and recorded in a command list
+		for (int mode = 0; mode < 4; ++mode) {
+			vector<uint8_t> images[2];
+			for (int layout = 0; layout < 2; ++layout) {
+				Renderer renderer(64, 64);
+				renderer.setRasterizer(rasterizer);
+				renderer.disableCulling();
+				if (mode == 1) {
+					renderer.enableDeferredShading();
+				}
+				else if (mode == 2) {
+					renderer.setThreadCount(4);
+					renderer.enableDrawSorting();
+				}
+				renderer.setIndexBuffer(indices);
+				CommandList commandList;
+				if (layout == 0) {
+					renderer.setVertexBuffer(soup);
+					commandList.setVertexBuffer(std::make_shared<const vector<Vertex>>(soup));
+					commandList.drawTriangles(0, 100, PassThroughVertexShader(), colorPixelShader);
+				}
+				else {
+					renderer.setVertexBuffer(normalSoup);
+					commandList.setVertexBuffer(std::make_shared<const vector<NormalVertex>>(normalSoup));
+					commandList.drawTriangles(0, 100, normalVertexShader, normalPixelShader);
+				}
+				renderer.setRenderFunc([&](Renderer& renderer) {
+					if (mode == 3) {
+						renderer.execute(commandList);
+					}
+					else if (layout == 0) {
+						renderer.drawTriangles(0, 100, PassThroughVertexShader(), colorPixelShader);
+					}
+					else {
+						renderer.drawTriangles(0, 100, normalVertexShader, normalPixelShader);
+					}
+				});
+				renderer.render();
+				images[layout] = framebufferBytes(renderer);
+			}
+			XCTAssertTrue(images[0] == images[1]);
+		}
+	}
+}
+
+- (void)testDrawWithAnotherVertexTypeThanTheBufferIsSkipped {
+	// a NormalVertex shader on a buffer of Vertex draws nothing, the next matching draw is unaffected
+	Renderer renderer(32, 32);
+	renderer.setVertexBuffer(vector<Vertex>{{{-1, -1, 0.5f, 1}, {1, 0, 0, 1}}, {{1, -1, 0.5f, 1}, {1, 0, 0, 1}}, {{1, 1, 0.5f, 1}, {1, 0, 0, 1}}});
+	renderer.setIndexBuffer({0, 1, 2});
+	renderer.setRenderFunc([](Renderer& renderer) {
+		renderer.drawTriangles(0, 1, [](const NormalVertex& vertex) {
+			return vertex;
+		}, [](const NormalVertex& fragment) {
+			return vec4(0, 1, 0, 1);
+		});
+	});
+	renderer.render();
+	XCTAssertEqual(pixelAt(renderer, 24, 8).g, 0);
+	renderer.setRenderFunc([](Renderer& renderer) {
+		renderer.drawTriangles(0, 1, PassThroughVertexShader(), VertexColorPixelShader());
+	});
+	renderer.render();
+	XCTAssertEqual(pixelAt(renderer, 24, 8).r, 255);
+}
+
+- (void)testLayoutWithoutVaryingsKeepsTheInterpolatedW {
+	// a quad at w = 2, the pixel shader only reads the window position
+	const vector<Vertex> vertexes = {{{-2, -2, 1, 2}}, {{2, -2, 1, 2}}, {{2, 2, 1, 2}}, {{-2, 2, 1, 2}}};
+	Renderer renderer(32, 32);
+	renderer.setVertexBuffer(vertexes);
+	renderer.setIndexBuffer({0, 1, 2, 0, 2, 3});
+	for (RasterizerType rasterizer : {scanline, halfSpace}) {
+		renderer.setRasterizer(rasterizer);
+		renderer.setRenderFunc([](Renderer& renderer) {
+			renderer.drawTriangles(0, 2, [](const Vertex& vertex) {
+				return ClipPosition{vertex.position};
+			}, [](const ClipPosition& fragment) {
+				return vec4(1, 0, fragment.position.w == 0.5f ? 1 : 0, 1);
+			});
+		});
+		renderer.render();
+		const Pixel center = pixelAt(renderer, 16, 16);
+		XCTAssertEqual(center.r, 255);
+		XCTAssertEqual(center.b, 255);
+	}
+}
+
 @end